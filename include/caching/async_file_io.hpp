@@ -0,0 +1,479 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define CACHING_HAS_IO_URING 1
+#else
+#define CACHING_HAS_IO_URING 0
+#endif
+
+namespace caching {
+
+///
+/// \brief An engine for asynchronous positional reads and writes on files.
+/// This engine is not thread-safe; it is meant to be driven by one thread.
+///
+/// Requests are queued by read() and write() and handed to the kernel in
+/// batches by submit(). poll() reaps completed requests and invokes their
+/// callbacks on the calling thread, so the callbacks may safely access
+/// single-threaded data structures like lru_cache.
+///
+/// On Linux, the engine uses io_uring, so one thread can keep many requests
+/// in flight with one system call per batch. If io_uring is not available
+/// (old kernel, seccomp filter, or not compiled in), it falls back to a pool
+/// of threads that perform blocking pread/pwrite calls.
+class async_file_io {
+public:
+  /// \brief Invoked as callback(result, data) when a request completes.
+  /// result is the number of bytes transferred or -errno on failure. For
+  /// reads, data contains the bytes read; for writes, it contains the written
+  /// buffer.
+  using callback_type = std::function<void(int, std::string &&)>;
+
+private:
+  struct Request {
+    int fd;
+    bool isWrite;
+    uint64_t offset;
+    std::string buffer;
+    callback_type callback;
+    iovec iov;
+    int result;
+  };
+
+  /// Requests are referred to by their index. The deque keeps the addresses
+  /// of the requests stable while they are in flight
+  std::deque<Request> requests;
+  std::vector<uint32_t> freeRequests;
+  /// Queued by read()/write(), but not submitted yet
+  std::deque<uint32_t> pending;
+  /// Submitted, but not consumed by the kernel yet (io_uring only)
+  unsigned numQueued = 0;
+  /// Failed to submit. Their callbacks are invoked by the next poll()
+  std::vector<uint32_t> failed;
+  size_t numInFlight = 0;
+
+  uint32_t allocRequest(int fd, bool isWrite, uint64_t offset,
+                        std::string &&buffer, callback_type &&callback) {
+    uint32_t idx;
+    if (!freeRequests.empty()) {
+      idx = freeRequests.back();
+      freeRequests.pop_back();
+    } else {
+      idx = uint32_t(requests.size());
+      if (workers.empty()) {
+        requests.emplace_back();
+      } else {
+        // The worker threads index into the deque concurrently
+        std::lock_guard<std::mutex> lck(mtx);
+        requests.emplace_back();
+      }
+    }
+    auto &req = requests[idx];
+    req.fd = fd;
+    req.isWrite = isWrite;
+    req.offset = offset;
+    req.buffer = std::move(buffer);
+    req.callback = std::move(callback);
+    req.result = 0;
+    return idx;
+  }
+
+  void complete(uint32_t idx, int result) {
+    auto &req = requests[idx];
+    auto callback = std::move(req.callback);
+    auto buffer = std::move(req.buffer);
+    if (!req.isWrite)
+      buffer.resize(result > 0 ? size_t(result) : 0);
+    freeRequests.push_back(idx);
+    if (callback)
+      callback(result, std::move(buffer));
+  }
+
+  /// Performs a request with blocking system calls
+  static int perform(Request &req) noexcept {
+    size_t done = 0;
+    while (done < req.buffer.size()) {
+      auto n = req.isWrite
+                   ? ::pwrite(req.fd, req.buffer.data() + done,
+                              req.buffer.size() - done, off_t(req.offset + done))
+                   : ::pread(req.fd, req.buffer.data() + done,
+                             req.buffer.size() - done, off_t(req.offset + done));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return -errno;
+      if (n == 0)
+        break;
+      done += n;
+    }
+    return int(done);
+  }
+
+#if CACHING_HAS_IO_URING
+  struct Ring {
+    int fd = -1;
+    void *sqPtr = nullptr;
+    void *cqPtr = nullptr;
+    size_t sqLen = 0, cqLen = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqesLen = 0;
+
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_cqe *cqes;
+    unsigned sqEntries, cqEntries;
+
+    bool init(unsigned entries) noexcept {
+      io_uring_params params{};
+      fd = int(::syscall(__NR_io_uring_setup, entries, &params));
+      if (fd < 0)
+        return false;
+
+      sqLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      cqLen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+      if (singleMmap)
+        sqLen = cqLen = std::max(sqLen, cqLen);
+
+      sqPtr = ::mmap(nullptr, sqLen, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      if (sqPtr == MAP_FAILED)
+        return destroy(), false;
+
+      if (singleMmap) {
+        cqPtr = sqPtr;
+      } else {
+        cqPtr = ::mmap(nullptr, cqLen, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqPtr == MAP_FAILED)
+          return cqPtr = nullptr, destroy(), false;
+      }
+
+      sqesLen = params.sq_entries * sizeof(io_uring_sqe);
+      sqes = static_cast<io_uring_sqe *>(
+          ::mmap(nullptr, sqesLen, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+      if (sqes == MAP_FAILED)
+        return sqes = nullptr, destroy(), false;
+
+      auto *sq = static_cast<char *>(sqPtr);
+      sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+      sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+      sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+      sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+      auto *cq = static_cast<char *>(cqPtr);
+      cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+      cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+      cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+      cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+      sqEntries = params.sq_entries;
+      cqEntries = params.cq_entries;
+      return true;
+    }
+
+    void destroy() noexcept {
+      if (sqes)
+        ::munmap(sqes, sqesLen);
+      if (cqPtr && cqPtr != sqPtr)
+        ::munmap(cqPtr, cqLen);
+      if (sqPtr && sqPtr != MAP_FAILED)
+        ::munmap(sqPtr, sqLen);
+      if (fd >= 0)
+        ::close(fd);
+      *this = Ring();
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete) noexcept {
+      unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+      int ret;
+      do {
+        ret = int(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete,
+                            flags, nullptr, 0));
+      } while (ret < 0 && errno == EINTR);
+      return ret;
+    }
+  };
+
+  Ring ring;
+
+  /// Hands the queued SQEs to the kernel and waits for minComplete
+  /// completions. SQEs that the kernel does not consume, because it lacks
+  /// resources (EAGAIN, EBUSY), stay queued for the next call. On other
+  /// errors, the queued requests fail with the error.
+  /// \return 0, or -errno if io_uring_enter failed
+  int enterRing(unsigned minComplete) {
+    auto ret = ring.enter(numQueued, minComplete);
+    if (ret >= 0) {
+      numQueued -= unsigned(ret);
+      numInFlight += unsigned(ret);
+      return 0;
+    }
+
+    auto err = errno;
+    if (err != EAGAIN && err != EBUSY && numQueued) {
+      // The kernel has not seen these SQEs, so they can be taken back
+      auto tail = *ring.sqTail;
+      for (auto pos = tail - numQueued; pos != tail; ++pos) {
+        auto idx = uint32_t(ring.sqes[pos & *ring.sqMask].user_data);
+        requests[idx].result = -err;
+        failed.push_back(idx);
+      }
+      __atomic_store_n(ring.sqTail, tail - numQueued, __ATOMIC_RELEASE);
+      numQueued = 0;
+    }
+    return -err;
+  }
+#endif
+
+  // State of the thread-pool fallback
+  std::vector<std::thread> workers;
+  std::mutex mtx;
+  std::condition_variable workAvailable;
+  std::condition_variable completionAvailable;
+  std::deque<uint32_t> workQueue;
+  std::deque<uint32_t> completed;
+  bool stopping = false;
+
+  void workerLoop() {
+    std::unique_lock<std::mutex> lck(mtx);
+    while (true) {
+      workAvailable.wait(lck, [this] { return stopping || !workQueue.empty(); });
+      if (workQueue.empty())
+        return;
+
+      auto idx = workQueue.front();
+      workQueue.pop_front();
+      auto &req = requests[idx];
+      lck.unlock();
+      req.result = perform(req);
+      lck.lock();
+      completed.push_back(idx);
+      completionAvailable.notify_one();
+    }
+  }
+
+public:
+  /// \brief Creates a new engine.
+  /// \param queueDepth The maximum number of requests in flight at a time
+  /// \param fallbackThreads The number of threads to use if io_uring is not
+  /// available
+  /// \param preferIoUring False, iff the thread-pool fallback should be used
+  /// even if io_uring is available
+  explicit async_file_io(unsigned queueDepth = 256,
+                         unsigned fallbackThreads = 4,
+                         bool preferIoUring = true) {
+#if CACHING_HAS_IO_URING
+    if (preferIoUring && ring.init(queueDepth ? queueDepth : 1))
+      return;
+#else
+    (void)preferIoUring;
+#endif
+    if (!fallbackThreads)
+      fallbackThreads = 1;
+    for (unsigned i = 0; i < fallbackThreads; ++i)
+      workers.emplace_back([this] { workerLoop(); });
+  }
+
+  async_file_io(const async_file_io &) = delete;
+  async_file_io &operator=(const async_file_io &) = delete;
+
+  /// \brief Waits for all requests in flight without invoking their callbacks
+  ~async_file_io() {
+#if CACHING_HAS_IO_URING
+    if (ring.fd >= 0) {
+      while (numInFlight) {
+        if (ring.enter(0, 1) < 0)
+          break;
+        auto head = *ring.cqHead;
+        auto tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        numInFlight -= tail - head;
+        __atomic_store_n(ring.cqHead, tail, __ATOMIC_RELEASE);
+      }
+      ring.destroy();
+      return;
+    }
+#endif
+    {
+      std::lock_guard<std::mutex> lck(mtx);
+      stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  /// \brief True, iff the engine uses io_uring rather than the thread pool
+  bool usesIoUring() const noexcept {
+#if CACHING_HAS_IO_URING
+    return ring.fd >= 0;
+#else
+    return false;
+#endif
+  }
+
+  /// \brief The number of requests that are queued or in flight, or whose
+  /// failure has not been reported by poll() yet
+  size_t outstanding() const noexcept {
+    return pending.size() + numQueued + failed.size() + numInFlight;
+  }
+
+  /// \brief Queues reading length bytes at offset from fd. Call submit() to
+  /// start the request.
+  void read(int fd, uint64_t offset, uint32_t length, callback_type callback) {
+    pending.push_back(allocRequest(fd, false, offset, std::string(length, '\0'),
+                                   std::move(callback)));
+  }
+
+  /// \brief Queues writing data at offset to fd. Call submit() to start the
+  /// request.
+  void write(int fd, uint64_t offset, std::string data,
+             callback_type callback) {
+    pending.push_back(
+        allocRequest(fd, true, offset, std::move(data), std::move(callback)));
+  }
+
+  /// \brief Hands all queued requests to the kernel (or the thread pool) as
+  /// one batch, as far as the queue depth permits. Requests that the kernel
+  /// does not accept for a lack of resources are retried by the next call of
+  /// submit() or poll(). Requests that it rejects otherwise fail, and poll()
+  /// invokes their callbacks with the error.
+  /// \return The number of requests, that the kernel (or the thread pool)
+  /// accepted
+  unsigned submit() {
+    unsigned numSubmitted = 0;
+#if CACHING_HAS_IO_URING
+    if (ring.fd >= 0) {
+      auto tail = *ring.sqTail;
+      auto head = __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+      while (!pending.empty() && tail - head < ring.sqEntries &&
+             numInFlight + numQueued < ring.cqEntries) {
+        auto idx = pending.front();
+        pending.pop_front();
+        auto &req = requests[idx];
+        req.iov = {req.buffer.data(), req.buffer.size()};
+
+        auto slot = tail & *ring.sqMask;
+        auto &sqe = ring.sqes[slot];
+        sqe = io_uring_sqe{};
+        sqe.opcode = req.isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe.fd = req.fd;
+        sqe.off = req.offset;
+        sqe.addr = reinterpret_cast<uint64_t>(&req.iov);
+        sqe.len = 1;
+        sqe.user_data = idx;
+        ring.sqArray[slot] = slot;
+        ++tail;
+        ++numQueued;
+      }
+      __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+      if (numQueued) {
+        auto before = numInFlight;
+        enterRing(0);
+        numSubmitted = unsigned(numInFlight - before);
+      }
+      return numSubmitted;
+    }
+#endif
+    if (pending.empty())
+      return 0;
+    {
+      std::lock_guard<std::mutex> lck(mtx);
+      numSubmitted = unsigned(pending.size());
+      workQueue.insert(workQueue.end(), pending.begin(), pending.end());
+    }
+    pending.clear();
+    numInFlight += numSubmitted;
+    workAvailable.notify_all();
+    return numSubmitted;
+  }
+
+  /// \brief Reaps completed requests and invokes their callbacks. Also
+  /// retries the submission of requests that the kernel did not accept yet.
+  /// \param minComplete The number of completions to wait for, as far as
+  /// requests are in flight
+  /// \return The number of completed requests
+  /// \throws std::system_error if waiting for completions fails
+  unsigned poll(unsigned minComplete = 0) {
+    unsigned numCompleted = 0;
+#if CACHING_HAS_IO_URING
+    if (ring.fd >= 0) {
+      do {
+        if (minComplete > numCompleted + numInFlight + failed.size())
+          minComplete = unsigned(numCompleted + numInFlight + failed.size());
+
+        int err = 0;
+        if (numQueued || numCompleted + failed.size() < minComplete) {
+          auto wait = numCompleted + failed.size() < minComplete
+                          ? unsigned(minComplete - numCompleted - failed.size())
+                          : 0;
+          err = enterRing(wait);
+        }
+
+        unsigned reaped = 0;
+        auto head = *ring.cqHead;
+        auto tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+          auto &cqe = ring.cqes[head & *ring.cqMask];
+          auto idx = uint32_t(cqe.user_data);
+          auto res = cqe.res;
+          __atomic_store_n(ring.cqHead, head + 1, __ATOMIC_RELEASE);
+          --numInFlight;
+          ++reaped;
+          // The callback may queue and submit new requests
+          complete(idx, res);
+        }
+        while (!failed.empty()) {
+          auto idx = failed.back();
+          failed.pop_back();
+          ++reaped;
+          complete(idx, requests[idx].result);
+        }
+        numCompleted += reaped;
+
+        if (err && !reaped && numCompleted < minComplete)
+          throw std::system_error(-err, std::generic_category(),
+                                  "io_uring_enter");
+      } while (numCompleted < minComplete);
+      return numCompleted;
+    }
+#endif
+    if (minComplete > numInFlight)
+      minComplete = unsigned(numInFlight);
+
+    do {
+      std::deque<uint32_t> done;
+      {
+        std::unique_lock<std::mutex> lck(mtx);
+        if (numCompleted < minComplete)
+          completionAvailable.wait(lck, [this] { return !completed.empty(); });
+        done.swap(completed);
+      }
+      for (auto idx : done) {
+        ++numCompleted;
+        --numInFlight;
+        complete(idx, requests[idx].result);
+      }
+    } while (numCompleted < minComplete);
+    return numCompleted;
+  }
+};
+} // namespace caching
@@ -0,0 +1,232 @@
+#pragma once
+
+// Requires C++20 coroutines. In older language modes, this header is empty.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "caching/lru_cache.hpp"
+
+namespace caching {
+
+/// \brief An executor that resumes coroutines immediately on the current
+/// thread
+struct inline_executor {
+  void operator()(std::coroutine_handle<> handle) const { handle.resume(); }
+};
+
+namespace detail {
+/// \brief A coroutine that starts eagerly and destroys itself on completion.
+/// The coroutine must handle all exceptions itself.
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+/// \brief Continues the awaiting coroutine on executor
+template <typename Executor> struct resume_on {
+  Executor &executor;
+
+  bool await_ready() const noexcept {
+    return std::is_same_v<Executor, inline_executor>;
+  }
+  void await_suspend(std::coroutine_handle<> handle) { executor(handle); }
+  void await_resume() const noexcept {}
+};
+
+/// \brief A coroutine that waits for a pending load
+template <typename TValue> struct load_waiter {
+  enum : int { Initial, Suspended, Completed };
+
+  load_waiter *next = nullptr;
+  std::coroutine_handle<> handle;
+  /// Resolves the race between the waiter suspending and the load completing
+  std::atomic<int> stage{Initial};
+  std::optional<TValue> result;
+  std::exception_ptr error;
+
+  /// Resumes handle on the executor of the waiter
+  virtual void schedule() = 0;
+
+  void complete() {
+    if (stage.exchange(Completed, std::memory_order_acq_rel) == Suspended)
+      schedule();
+  }
+
+protected:
+  ~load_waiter() = default;
+};
+} // namespace detail
+
+///
+/// \brief An lru_cache with a coroutine-based getOrLoad API. This cache is
+/// not thread-safe: It must only be accessed from one thread, typically the
+/// thread of a single-threaded executor.
+///
+/// Cache hits complete synchronously without suspending or allocating.
+/// On a miss, the first awaiter starts the loader, and all concurrent
+/// awaiters of the same key share that load instead of starting their own.
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam TValue The type of cached values
+/// \tparam AllocBlockSize The number of elements to allocate at once to reduce
+/// the number of total allocations
+template <typename TKey, typename TValue, unsigned AllocBlockSize = 1024>
+class async_lru_cache {
+  using WaiterTy = detail::load_waiter<TValue>;
+
+  lru_cache<TKey, TValue, AllocBlockSize> cache;
+  /// The waiters of each pending load, linked through load_waiter::next
+  std::unordered_map<TKey, WaiterTy *> pending;
+
+  template <typename Loader, typename Executor>
+  detail::detached_task runLoad(TKey key, Loader loader, Executor executor) {
+    std::optional<TValue> value;
+    std::exception_ptr error;
+    try {
+      value.emplace(co_await loader(std::as_const(key)));
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    // The loader may have completed on a different thread
+    co_await detail::resume_on<Executor>{executor};
+
+    auto it = pending.find(key);
+    WaiterTy *waiters = it->second;
+    pending.erase(it);
+
+    // Caching or copying the value may throw as well, e.g. in the eviction
+    // handler. Such errors are rethrown to the waiters without a result.
+    try {
+      if (value) {
+        auto *stored = cache.insert(std::move(key), std::move(*value)).first;
+        for (auto *w = waiters; w; w = w->next)
+          w->result.emplace(*stored);
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+    if (error) {
+      for (auto *w = waiters; w; w = w->next) {
+        if (!w->result)
+          w->error = error;
+      }
+    }
+
+    // Resuming a waiter may modify the cache or end the waiter's lifetime
+    while (waiters) {
+      auto *nxt = waiters->next;
+      waiters->complete();
+      waiters = nxt;
+    }
+  }
+
+  template <typename Loader, typename Executor>
+  class get_or_load_awaiter final : private WaiterTy {
+    friend class async_lru_cache;
+
+    async_lru_cache &owner;
+    const TKey &key;
+    Loader loader;
+    Executor executor;
+    TValue *hit = nullptr;
+
+    void schedule() override { executor(this->handle); }
+
+    get_or_load_awaiter(async_lru_cache &owner, const TKey &key, Loader loader,
+                        Executor executor)
+        : owner(owner), key(key), loader(std::move(loader)),
+          executor(std::move(executor)) {}
+
+  public:
+    bool await_ready() {
+      if (auto ret = owner.cache.get(key)) {
+        hit = &ret->get();
+        return true;
+      }
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      this->handle = handle;
+      WaiterTy *self = this;
+      auto [it, inserted] = owner.pending.try_emplace(key, self);
+      if (inserted)
+        owner.runLoad(key, std::move(loader), executor);
+      else
+        this->next = std::exchange(it->second, self);
+
+      // Do not suspend, if the load has already completed
+      return this->stage.exchange(WaiterTy::Suspended,
+                                  std::memory_order_acq_rel) !=
+             WaiterTy::Completed;
+    }
+
+    TValue await_resume() {
+      if (hit)
+        return *hit;
+      if (this->error)
+        std::rethrow_exception(this->error);
+      return std::move(*this->result);
+    }
+  };
+
+public:
+  /// \brief Initializes a new, empty async_lru_cache
+  /// \param limit The maximum number of elements that can be cached at a time
+  explicit async_lru_cache(size_t limit) : cache(limit) {}
+
+  /// \brief This type is neither copyable nor movable
+  async_lru_cache(const async_lru_cache &) = delete;
+  async_lru_cache &operator=(const async_lru_cache &) = delete;
+
+  /// \brief The underlying synchronous cache
+  lru_cache<TKey, TValue, AllocBlockSize> &sync() noexcept { return cache; }
+  const lru_cache<TKey, TValue, AllocBlockSize> &sync() const noexcept {
+    return cache;
+  }
+
+  /// \brief The number of keys that are currently being loaded
+  size_t pendingLoads() const noexcept { return pending.size(); }
+
+  /// \brief Looks up the value associated to key, loading it on a miss.
+  ///
+  /// The returned awaitable yields a copy of the cached value. On a hit, it
+  /// completes without suspending. On a miss, loader(key) is co_awaited to
+  /// obtain the value, unless another load of key is already pending, in which
+  /// case the awaiter joins that load. If the load throws, the exception is
+  /// rethrown to all awaiters of that load and nothing is cached. If caching
+  /// the loaded value throws (e.g. in the eviction handler), the exception is
+  /// rethrown to all awaiters as well.
+  /// \param key The key to search for. Must stay alive until the awaitable
+  /// is resumed
+  /// \param loader A callable that takes the key and returns an awaitable
+  /// that yields a value convertible to TValue. It is copied or moved into
+  /// the awaitable
+  /// \param executor A callable that takes a std::coroutine_handle<> and
+  /// resumes it on the caller's executor. It is copied or moved into the
+  /// awaitable. The cache is accessed after the load on the executor of the
+  /// awaiter that started it
+  template <typename Loader, typename Executor = inline_executor>
+  auto asyncGetOrLoad(const TKey &key, Loader &&loader,
+                      Executor &&executor = {}) {
+    return get_or_load_awaiter<std::decay_t<Loader>, std::decay_t<Executor>>(
+        *this, key, std::forward<Loader>(loader),
+        std::forward<Executor>(executor));
+  }
+};
+} // namespace caching
+
+#endif
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "caching/hash.hpp"
+#include "caching/key_arena.hpp"
+#include "caching/memory_stats.hpp"
+
+namespace caching {
+
+///
+/// \brief An LRU cache with a fixed dynamic limit and a compact memory
+/// layout. This cache is not thread-safe.
+///
+/// As opposed to lru_cache, which stores each entry in a list node and a map
+/// node, compact_lru_cache stores the key, the value, the hash and the LRU
+/// links of an entry in a single node. The nodes live in one contiguous array
+/// and link to each other with 32-bit indices.
+///
+/// The index is an open-addressing table with linear probing, whose slots
+/// hold the 32-bit hash of the key next to the node index. Probes skip all
+/// slots with a different hash without touching the nodes, so the key bytes
+/// are usually only read for the entry that is actually searched. Growing the
+/// index moves the slots by their stored hashes and never hashes a key again.
+/// The per-entry overhead is 12 bytes plus 8 bytes per index slot (at most
+/// 3/4 of the slots are used) instead of roughly 40 or more bytes.
+///
+/// The node array grows on demand up to the limit. Hence, pointers and
+/// references to cached values are only valid until the next insertion.
+///
+/// How the keys are stored in the nodes is determined by the key storage
+/// policy: inline_key_storage stores the keys themselves, arena_key_storage
+/// copies variable-length keys into an arena owned by the cache (see
+/// arena_lru_cache).
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam TValue The type of cached values
+/// \tparam THash The hash function. The index uses a power-of-two number of
+/// slots, so the hash must spread the keys over the lower bits. Must be
+/// callable with the lookup_type of TKeyStorage
+/// \tparam TKeyEqual The key comparison function
+/// \tparam TKeyStorage The key storage policy
+template <typename TKey, typename TValue, typename THash = hash<TKey>,
+          typename TKeyEqual = std::equal_to<TKey>,
+          typename TKeyStorage = inline_key_storage<TKey, TKeyEqual>>
+class compact_lru_cache {
+public:
+  using index_type = uint32_t;
+  /// The type of the key arguments of lookups
+  using key_type = typename TKeyStorage::lookup_type;
+
+private:
+  static constexpr index_type Nil = ~index_type(0);
+
+  using StoredKeyTy = typename TKeyStorage::stored_type;
+
+  struct Node {
+    StoredKeyTy key;
+    TValue value;
+    /// The lower 32 bits of the hash of key
+    uint32_t hash;
+    index_type prev;
+    /// The next node in LRU order, or in the freelist
+    index_type next;
+
+    template <typename V>
+    Node(StoredKeyTy &&key, V &&value, uint32_t hash)
+        : key(std::move(key)), value(std::forward<V>(value)), hash(hash) {}
+  };
+
+  struct Slot {
+    uint32_t hash;
+    /// The node of this slot, or Nil if the slot is empty
+    index_type node;
+  };
+
+  std::vector<Node> nodes;
+  /// The number of slots is a power of two
+  std::vector<Slot> slots;
+
+  index_type limit;
+  index_type count = 0;
+  /// Least recently used entry
+  index_type head = Nil;
+  /// Most recently used entry
+  index_type tail = Nil;
+  index_type freeList = Nil;
+
+  THash hasher;
+  TKeyStorage keys;
+
+  uint32_t hashOf(const key_type &key) const { return uint32_t(hasher(key)); }
+
+  size_t mask() const noexcept { return slots.size() - 1; }
+
+  /// The slot of key, or slots.size() if key is not present
+  size_t findSlot(const key_type &key, uint32_t hash) const {
+    for (auto pos = hash & mask(); slots[pos].node != Nil;
+         pos = (pos + 1) & mask()) {
+      // Only touch the node of slots with a matching hash
+      if (slots[pos].hash == hash &&
+          keys.equals(nodes[slots[pos].node].key, key))
+        return pos;
+    }
+    return slots.size();
+  }
+
+  index_type find(const key_type &key, uint32_t hash) const {
+    auto pos = findSlot(key, hash);
+    return pos == slots.size() ? Nil : slots[pos].node;
+  }
+
+  void unlinkList(index_type i) noexcept {
+    auto &nod = nodes[i];
+    if (nod.prev != Nil)
+      nodes[nod.prev].next = nod.next;
+    else
+      head = nod.next;
+
+    if (nod.next != Nil)
+      nodes[nod.next].prev = nod.prev;
+    else
+      tail = nod.prev;
+  }
+
+  void pushBack(index_type i) noexcept {
+    auto &nod = nodes[i];
+    nod.prev = tail;
+    nod.next = Nil;
+    if (tail != Nil)
+      nodes[tail].next = i;
+    else
+      head = i;
+    tail = i;
+  }
+
+  void touch(index_type i) noexcept {
+    if (tail != i) {
+      unlinkList(i);
+      pushBack(i);
+    }
+  }
+
+  void insertSlot(Slot slot) noexcept {
+    auto pos = slot.hash & mask();
+    while (slots[pos].node != Nil)
+      pos = (pos + 1) & mask();
+    slots[pos] = slot;
+  }
+
+  /// Removes the slot of node i by shifting back the following slots of its
+  /// probe sequence. Only compares node indices and stored hashes.
+  void eraseSlot(index_type i) noexcept {
+    auto hole = nodes[i].hash & mask();
+    while (slots[hole].node != i) {
+      assert(slots[hole].node != Nil && "The node is not in the index");
+      hole = (hole + 1) & mask();
+    }
+
+    for (auto pos = (hole + 1) & mask(); slots[pos].node != Nil;
+         pos = (pos + 1) & mask()) {
+      auto home = slots[pos].hash & mask();
+      bool movable = hole <= pos ? (home <= hole || home > pos)
+                                 : (home <= hole && home > pos);
+      if (movable) {
+        slots[hole] = slots[pos];
+        hole = pos;
+      }
+    }
+    slots[hole].node = Nil;
+  }
+
+  /// Grows the index, such that at most 3/4 of its slots are needed for
+  /// numEntries entries. Moves the slots by their stored hashes, so no key is
+  /// hashed again.
+  void growIndex(size_t numEntries) {
+    auto numSlots = slots.size();
+    while (numEntries * 4 > numSlots * 3)
+      numSlots <<= 1;
+    if (numSlots == slots.size())
+      return;
+
+    std::vector<Slot> old(numSlots, Slot{0, Nil});
+    old.swap(slots);
+    for (auto &slot : old) {
+      if (slot.node != Nil)
+        insertSlot(slot);
+    }
+  }
+
+public:
+  /// \brief Initializes a new, empty compact_lru_cache
+  /// \param limit The maximum number of elements that can be cached at a time
+  /// \param initCap The number of elements for those memory should be
+  /// preallocated
+  explicit compact_lru_cache(size_t limit, size_t initCap = 16)
+      : limit(index_type(limit)) {
+    assert(limit && limit < Nil && "Invalid cache-limit");
+    if (initCap > limit)
+      initCap = limit;
+
+    nodes.reserve(initCap);
+    slots.assign(4, Slot{0, Nil});
+    growIndex(initCap);
+  }
+
+  /// \brief The number of entries currently in the cache
+  size_t size() const noexcept { return count; }
+
+  /// \brief True, iff the cache contains no entries
+  bool empty() const noexcept { return count == 0; }
+
+  /// \brief The maximum number of entries that can be cached at a time
+  size_t getLimit() const noexcept { return limit; }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true.
+  ///
+  /// If the limit is reached, the least recently used entry is replaced.
+  /// \return A tuple, where the first element is a pointer to the cached value
+  /// and the second element denotes whether the insertion actually took
+  /// place. The pointer is valid until the next insertion.
+  template <typename K, typename V>
+  std::pair<TValue *, bool> insert(K &&key, V &&value, bool update = false) {
+    const key_type &lookupKey = key;
+    auto hash = hashOf(lookupKey);
+    if (auto i = find(lookupKey, hash); i != Nil) {
+      touch(i);
+      if (update)
+        nodes[i].value = std::forward<V>(value);
+      return {&nodes[i].value, false};
+    }
+
+    index_type i;
+    if (count < limit) {
+      if (freeList != Nil) {
+        i = freeList;
+        freeList = nodes[i].next;
+        nodes[i].key = keys.store(std::forward<K>(key));
+        nodes[i].value = std::forward<V>(value);
+        nodes[i].hash = hash;
+      } else {
+        i = index_type(nodes.size());
+        nodes.emplace_back(keys.store(std::forward<K>(key)),
+                           std::forward<V>(value), hash);
+      }
+      ++count;
+      growIndex(count);
+    } else {
+      // Recycle the least recently used node
+      i = head;
+      eraseSlot(i);
+      unlinkList(i);
+      keys.release(nodes[i].key);
+      nodes[i].key = keys.store(std::forward<K>(key));
+      nodes[i].value = std::forward<V>(value);
+      nodes[i].hash = hash;
+    }
+
+    insertSlot({hash, i});
+    pushBack(i);
+    return {&nodes[i].value, true};
+  }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key
+  /// \return A mutable reference to the cached value
+  template <typename K, typename V> TValue &getOrInsert(K &&key, V &&value) {
+    return *insert(std::forward<K>(key), std::forward<V>(value), false).first;
+  }
+
+  /// \brief Looks up the value associated to key in the cache. Updates the LRU
+  /// order.
+  /// \return A mutable reference to the cached value associated with key if
+  /// found. Returns std::nullopt, iff key is not present in the cache.
+  std::optional<std::reference_wrapper<TValue>> get(const key_type &key) {
+    auto i = find(key, hashOf(key));
+    if (i == Nil)
+      return std::nullopt;
+
+    touch(i);
+    return std::ref(nodes[i].value);
+  }
+
+  /// \brief Same as get(const TKey&), but without updating the LRU order.
+  std::optional<std::reference_wrapper<const TValue>>
+  peek(const key_type &key) const {
+    auto i = find(key, hashOf(key));
+    if (i == Nil)
+      return std::nullopt;
+
+    return std::cref(nodes[i].value);
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// Its node is reused by later insertions.
+  /// \return True, iff an entry was removed
+  bool erase(const key_type &key) {
+    auto i = find(key, hashOf(key));
+    if (i == Nil)
+      return false;
+
+    eraseSlot(i);
+    unlinkList(i);
+    keys.release(nodes[i].key);
+    nodes[i].next = freeList;
+    freeList = i;
+    --count;
+    return true;
+  }
+
+  /// \brief Removes all entries from the cache. The memory is kept for reuse.
+  void clear() noexcept {
+    nodes.clear();
+    keys.clear();
+    slots.assign(slots.size(), Slot{0, Nil});
+    count = 0;
+    head = tail = freeList = Nil;
+  }
+
+  /// \brief Reports the memory used by this cache
+  memory_stats memoryUsage() const noexcept {
+    memory_stats ret;
+    ret.entries = count;
+    ret.payloadBytes = count * (sizeof(StoredKeyTy) + sizeof(TValue));
+    ret.totalBytes = sizeof(*this) + nodes.capacity() * sizeof(Node) +
+                     slots.capacity() * sizeof(Slot) + keys.memoryUsage();
+    return ret;
+  }
+
+  /// \brief Iterates all entries in the cache in LRU order (least recently used
+  /// first) and calls fn(key, value) for each entry. Does not update the
+  /// LRU order.
+  template <typename Fn> void forEach(Fn &&fn) const {
+    for (auto i = head; i != Nil; i = nodes[i].next)
+      fn(keys.view(nodes[i].key), static_cast<const TValue &>(nodes[i].value));
+  }
+};
+
+/// \brief A compact_lru_cache with string keys that are stored in an arena
+/// owned by the cache. Lookups take std::string_view.
+template <typename TValue, typename THash = hash<std::string>>
+using arena_lru_cache = compact_lru_cache<std::string, TValue, THash,
+                                          std::equal_to<>, arena_key_storage>;
+} // namespace caching
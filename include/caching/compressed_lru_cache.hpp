@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "caching/hash.hpp"
+#include "caching/lru_cache.hpp"
+
+namespace caching {
+
+///
+/// \brief A codec for the LZ4 block format (without frame header).
+///
+/// The compressor is a simple greedy single-pass matcher with a 4096-entry
+/// hash table, which favours speed over compression ratio. The decompressor
+/// validates all offsets and lengths, so it is safe on corrupted input.
+struct lz4_codec {
+  /// \brief Appends the compressed form of in to out
+  static void compress(std::string_view in, std::string &out) {
+    constexpr size_t MinMatch = 4;
+    constexpr size_t MatchFindLimit = 12;
+    constexpr size_t LastLiterals = 5;
+    constexpr unsigned HashBits = 12;
+    constexpr uint32_t NoPos = ~uint32_t(0);
+
+    auto *src = reinterpret_cast<const uint8_t *>(in.data());
+    const size_t len = in.size();
+    size_t anchor = 0;
+
+    if (len > MatchFindLimit) {
+      uint32_t table[1 << HashBits];
+      std::fill(std::begin(table), std::end(table), NoPos);
+
+      const size_t matchLimit = len - LastLiterals;
+      for (size_t ip = 0; ip < len - MatchFindLimit;) {
+        uint32_t seq;
+        std::memcpy(&seq, src + ip, sizeof(seq));
+        auto h = (seq * 2654435761u) >> (32 - HashBits);
+        auto ref = table[h];
+        table[h] = uint32_t(ip);
+
+        if (ref == NoPos || ip - ref > 0xffff ||
+            std::memcmp(src + ref, src + ip, MinMatch) != 0) {
+          ++ip;
+          continue;
+        }
+
+        auto matchLen = MinMatch;
+        while (ip + matchLen < matchLimit &&
+               src[ref + matchLen] == src[ip + matchLen])
+          ++matchLen;
+
+        writeSequence(out, src + anchor, ip - anchor, uint16_t(ip - ref),
+                      matchLen - MinMatch);
+        ip += matchLen;
+        anchor = ip;
+      }
+    }
+
+    // The last sequence only consists of literals
+    writeToken(out, len - anchor, 0);
+    out.append(reinterpret_cast<const char *>(src + anchor), len - anchor);
+  }
+
+  /// \brief Decompresses in, which decompresses to rawSize bytes, into out.
+  /// \return False, iff in is malformed
+  static bool decompress(std::string_view in, size_t rawSize,
+                         std::string &out) {
+    out.resize(rawSize);
+    auto *ip = reinterpret_cast<const uint8_t *>(in.data());
+    auto *const iend = ip + in.size();
+    auto *op = reinterpret_cast<uint8_t *>(out.data());
+    auto *const ostart = op;
+    auto *const oend = op + rawSize;
+
+    auto readLength = [&](size_t len, size_t &ret) {
+      ret = len;
+      if (len != 15)
+        return true;
+      uint8_t byte;
+      do {
+        if (ip == iend)
+          return false;
+        byte = *ip++;
+        ret += byte;
+      } while (byte == 255);
+      return true;
+    };
+
+    while (ip < iend) {
+      auto token = *ip++;
+      size_t litLen;
+      if (!readLength(token >> 4, litLen) || size_t(iend - ip) < litLen ||
+          size_t(oend - op) < litLen)
+        return false;
+      std::memcpy(op, ip, litLen);
+      ip += litLen;
+      op += litLen;
+
+      if (ip == iend)
+        break;
+
+      if (iend - ip < 2)
+        return false;
+      size_t offset = ip[0] | (size_t(ip[1]) << 8);
+      ip += 2;
+      size_t matchLen;
+      if (!offset || size_t(op - ostart) < offset ||
+          !readLength(token & 15, matchLen))
+        return false;
+      matchLen += 4;
+      if (size_t(oend - op) < matchLen)
+        return false;
+
+      // The match may overlap the output, so copy bytewise
+      auto *match = op - offset;
+      for (size_t i = 0; i < matchLen; ++i)
+        op[i] = match[i];
+      op += matchLen;
+    }
+    return op == oend;
+  }
+
+private:
+  static void writeToken(std::string &out, size_t litLen, size_t matchLen) {
+    out.push_back(char((std::min<size_t>(litLen, 15) << 4) |
+                       std::min<size_t>(matchLen, 15)));
+    writeExtension(out, litLen);
+  }
+
+  static void writeExtension(std::string &out, size_t len) {
+    if (len < 15)
+      return;
+    for (len -= 15; len >= 255; len -= 255)
+      out.push_back(char(255));
+    out.push_back(char(len));
+  }
+
+  static void writeSequence(std::string &out, const uint8_t *literals,
+                            size_t litLen, uint16_t offset, size_t matchLen) {
+    writeToken(out, litLen, matchLen);
+    out.append(reinterpret_cast<const char *>(literals), litLen);
+    out.push_back(char(offset & 0xff));
+    out.push_back(char(offset >> 8));
+    writeExtension(out, matchLen);
+  }
+};
+
+///
+/// \brief An adaptor of lru_cache for blob values, that transparently
+/// compresses large values and bounds the cache by the number of stored bytes.
+/// This cache is not thread-safe.
+///
+/// Values of at least compressionThreshold bytes are compressed on insertion
+/// and stored compressed, if that makes them smaller. get() decompresses
+/// them. The byte limit counts the stored, i.e. compressed, sizes of the
+/// values, so compressible values let the same memory hold more entries.
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam TCodec The compression codec. Provides
+///     static void compress(std::string_view in, std::string &out);
+///     static bool decompress(std::string_view in, size_t rawSize,
+///                            std::string &out);
+/// \tparam THash The hash function for the keys
+template <typename TKey, typename TCodec = lz4_codec,
+          typename THash = hash<TKey>>
+class compressed_lru_cache {
+  struct Entry {
+    std::string data;
+    /// The size of the uncompressed value
+    size_t rawSize = 0;
+    bool compressed = false;
+  };
+
+  lru_cache<TKey, Entry, 1024, THash> cache;
+  size_t byteLimit;
+  size_t compressionThreshold;
+  size_t numBytes = 0;
+
+  Entry encode(std::string_view value) const {
+    Entry ret;
+    ret.rawSize = value.size();
+    if (value.size() >= compressionThreshold) {
+      TCodec::compress(value, ret.data);
+      if (ret.data.size() < value.size()) {
+        ret.compressed = true;
+        ret.data.shrink_to_fit();
+        return ret;
+      }
+      ret.data.clear();
+    }
+    ret.data.assign(value);
+    return ret;
+  }
+
+public:
+  /// \brief Initializes a new, empty compressed_lru_cache
+  /// \param byteLimit The maximum total number of stored value bytes
+  /// \param compressionThreshold The minimum size of values to compress
+  /// \param entryLimit The maximum number of entries, regardless of their
+  /// size
+  explicit compressed_lru_cache(
+      size_t byteLimit, size_t compressionThreshold = 256,
+      size_t entryLimit = std::numeric_limits<size_t>::max())
+      : cache(entryLimit), byteLimit(byteLimit),
+        compressionThreshold(compressionThreshold) {
+    cache.setEvictionHandler([this](const TKey &, Entry &&entry) {
+      numBytes -= entry.data.size();
+    });
+  }
+
+  /// \brief This type is neither copyable nor movable
+  compressed_lru_cache(const compressed_lru_cache &) = delete;
+  compressed_lru_cache &operator=(const compressed_lru_cache &) = delete;
+
+  /// \brief The number of entries currently in the cache
+  size_t size() const noexcept { return cache.size(); }
+
+  /// \brief The number of bytes used by the stored values
+  size_t bytes() const noexcept { return numBytes; }
+
+  /// \brief The maximum number of bytes used by the stored values
+  size_t getByteLimit() const noexcept { return byteLimit; }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true.
+  ///
+  /// Evicts least recently used entries until the stored values fit into the
+  /// byte limit. A single value that exceeds the byte limit is not cached.
+  /// \return True, iff the insertion actually took place
+  template <typename K>
+  bool insert(K &&key, std::string_view value, bool update = false) {
+    if (auto old = cache.get(key)) {
+      if (!update)
+        return false;
+      numBytes -= old->get().data.size();
+      cache.erase(key);
+    }
+
+    auto entry = encode(value);
+    if (entry.data.size() > byteLimit)
+      return false;
+
+    numBytes += entry.data.size();
+    while (numBytes > byteLimit)
+      cache.evictLeastRecentlyUsed();
+
+    // Account before inserting: The insertion may evict another entry due to
+    // the entry limit
+    cache.insert(std::forward<K>(key), std::move(entry));
+    return true;
+  }
+
+  /// \brief Looks up the value associated to key and decompresses it into
+  /// out. Updates the LRU order.
+  /// \return True, iff key is present in the cache
+  bool get(const TKey &key, std::string &out) {
+    auto entry = cache.get(key);
+    if (!entry)
+      return false;
+
+    auto &ent = entry->get();
+    if (!ent.compressed) {
+      out = ent.data;
+      return true;
+    }
+    return TCodec::decompress(ent.data, ent.rawSize, out);
+  }
+
+  /// \brief Same as get(const TKey&, std::string&), but returns a new string.
+  std::optional<std::string> get(const TKey &key) {
+    std::string ret;
+    if (!get(key, ret))
+      return std::nullopt;
+    return ret;
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) {
+    auto entry = cache.peek(key);
+    if (!entry)
+      return false;
+
+    numBytes -= entry->get().data.size();
+    return cache.erase(key);
+  }
+
+  /// \brief Removes all entries from the cache
+  void clear() {
+    cache.clear();
+    numBytes = 0;
+  }
+};
+} // namespace caching
@@ -0,0 +1,403 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
+
+#include "caching/hash.hpp"
+#include "caching/seqlock_cell.hpp"
+
+namespace caching {
+
+///
+/// \brief A thread-safe cache with CLOCK replacement, that locks individual
+/// slots instead of shards. Keys and values must be trivially copyable and
+/// default constructible.
+///
+/// The entries live in a single open-addressing table with linear probing and
+/// twice as many slots as the limit. Every slot has an atomic state word,
+/// which combines the state of the slot (empty, ready or busy) with a version
+/// that is incremented on every modification:
+/// - A writer claims a slot by a CAS to busy, modifies it and publishes it
+///   with a new version.
+/// - A reader copies key and value of a ready slot and validates the copy by
+///   reloading the state word; It never writes the slot, except for setting
+///   its reference bit, if that is not set yet. Readers wait (yielding) for
+///   busy slots in their probe sequence, so the cache is not lock-free, but
+///   a slot is only busy while a writer copies one entry.
+///
+/// Instead of tombstones, every slot counts the entries whose probe sequence
+/// passes it (their displacements). A lookup stops at the first slot that
+/// does not match and is not passed by any entry, so removing entries never
+/// lengthens later probes.
+///
+/// If the cache is full, an insertion advances the shared clock hand: Slots
+/// with a set reference bit get a second chance, the first one without is
+/// evicted. Since there are no shard locks, a few hot keys never serialize
+/// other threads.
+///
+/// Concurrent insertions of the same key may both claim a slot. Hence, an
+/// insertion probes the key again after publishing its entry and removes all
+/// copies but the first one in the probe sequence, which all insertions agree
+/// on. Lookups may return either value until then.
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam TValue The type of cached values
+/// \tparam THash The hash function. The lower bits select the home slot
+/// \tparam TKeyEqual The key comparison function
+template <typename TKey, typename TValue, typename THash = hash<TKey>,
+          typename TKeyEqual = std::equal_to<TKey>>
+class concurrent_clock_cache {
+  static_assert(std::is_trivially_copyable_v<TKey> &&
+                    std::is_trivially_copyable_v<TValue>,
+                "concurrent_clock_cache requires trivially copyable keys and "
+                "values");
+
+  enum : uint64_t { Empty = 0, Ready = 1, Busy = 2, StateMask = 3 };
+  static constexpr uint64_t VersionInc = 4;
+
+  struct Slot {
+    /// (version << 2) | state
+    std::atomic<uint64_t> state{Empty};
+    /// The number of entries that are stored behind this slot in their probe
+    /// sequence
+    std::atomic<uint32_t> displacements{0};
+    std::atomic<uint8_t> referenced{0};
+    /// Only accessed by the owner of the busy slot
+    uint32_t hash = 0;
+    detail::seqlock_cell<TKey> key;
+    detail::seqlock_cell<TValue> value;
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  size_t mask;
+  size_t limit;
+
+  /// The number of reserved entries. An insertion reserves its entry before
+  /// it claims a slot, and evicts, if that exceeds the limit
+  std::atomic<size_t> reserved{0};
+  std::atomic<size_t> count{0};
+  std::atomic<size_t> hand{0};
+
+  THash hasher;
+  TKeyEqual keyEqual;
+
+  static bool isReady(uint64_t state) noexcept {
+    return (state & StateMask) == Ready;
+  }
+
+  static uint64_t nextVersion(uint64_t state, uint64_t newState) noexcept {
+    return ((state & ~StateMask) + VersionInc) | newState;
+  }
+
+  /// Waits until slot is not busy and returns its state
+  static uint64_t loadStable(const Slot &slot) noexcept {
+    for (;;) {
+      auto state = slot.state.load(std::memory_order_acquire);
+      if ((state & StateMask) != Busy)
+        return state;
+      std::this_thread::yield();
+    }
+  }
+
+  /// Copies the entry of a slot in state, if it is ready and holds key
+  /// \return The validated copy of the value, or std::nullopt, if the slot
+  /// does not match. Sets state to the state, the copy was validated against
+  std::optional<TValue> readSlot(const Slot &slot, const TKey &key,
+                                 uint64_t &state) const noexcept {
+    for (;;) {
+      state = loadStable(slot);
+      if (!isReady(state))
+        return std::nullopt;
+
+      bool match = keyEqual(slot.key.load(), key);
+      auto value = slot.value.load();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.state.load(std::memory_order_relaxed) != state)
+        continue;
+
+      if (!match)
+        return std::nullopt;
+      return value;
+    }
+  }
+
+  /// Visits the slots of the probe sequence of hash, until fn returns true
+  /// or the probe sequence ends.
+  /// \return The position, where fn returned true, or mask+1
+  template <typename Fn>
+  size_t probe(uint32_t hash, Fn &&fn) const {
+    auto pos = hash & mask;
+    for (size_t i = 0; i <= mask; ++i) {
+      if (fn(pos))
+        return pos;
+      if (slots[pos].displacements.load(std::memory_order_acquire) == 0)
+        break;
+      pos = (pos + 1) & mask;
+    }
+    return mask + 1;
+  }
+
+  /// Removes the entry of a slot, that is owned by the caller (busy)
+  void removeOwned(size_t pos, uint64_t busyState) noexcept {
+    auto &slot = slots[pos];
+    for (auto i = slot.hash & mask; i != pos; i = (i + 1) & mask)
+      slots[i].displacements.fetch_sub(1, std::memory_order_release);
+
+    slot.referenced.store(0, std::memory_order_relaxed);
+    slot.state.store(nextVersion(busyState, Empty), std::memory_order_release);
+    count.fetch_sub(1, std::memory_order_relaxed);
+    reserved.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /// Removes all copies of key but the first one in its probe sequence, after
+  /// an insertion published the copy at pos.
+  /// \return True, iff the copy at pos is the first one or already gone
+  bool retireDuplicates(uint32_t hash, const TKey &key, size_t pos) {
+    // Pairs with the fence of a racing insertion of key, so that at least one
+    // of them sees the other's copy
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    auto first = mask + 1;
+    probe(hash, [&](size_t i) {
+      for (;;) {
+        uint64_t state;
+        if (!readSlot(slots[i], key, state))
+          return false;
+        if (first > mask) {
+          first = i;
+          return false;
+        }
+
+        auto busy = nextVersion(state, Busy);
+        if (slots[i].state.compare_exchange_strong(state, busy,
+                                                   std::memory_order_acquire)) {
+          removeOwned(i, busy);
+          return false;
+        }
+      }
+    });
+    return first > mask || first == pos;
+  }
+
+  /// Advances the clock hand until it evicts an entry.
+  /// \return False, iff no entry could be evicted in two revolutions
+  bool evictOne() noexcept {
+    for (size_t step = 0; step <= 2 * mask + 1; ++step) {
+      auto pos = hand.fetch_add(1, std::memory_order_relaxed) & mask;
+      auto &slot = slots[pos];
+      auto state = slot.state.load(std::memory_order_acquire);
+      if (!isReady(state))
+        continue;
+
+      // Second chance
+      if (slot.referenced.load(std::memory_order_relaxed)) {
+        slot.referenced.store(0, std::memory_order_relaxed);
+        continue;
+      }
+
+      auto busy = nextVersion(state, Busy);
+      if (slot.state.compare_exchange_strong(state, busy,
+                                             std::memory_order_acquire)) {
+        removeOwned(pos, busy);
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  /// \brief Initializes a new, empty concurrent_clock_cache
+  /// \param limit The maximum number of elements that can be cached at a
+  /// time. Concurrent insertions may exceed it temporarily by the number of
+  /// inserting threads
+  explicit concurrent_clock_cache(size_t limit) : limit(limit) {
+    assert(limit && "The cache-limit may not be 0");
+    size_t numSlots = 4;
+    while (numSlots < 2 * limit)
+      numSlots <<= 1;
+    mask = numSlots - 1;
+    slots = std::make_unique<Slot[]>(numSlots);
+  }
+
+  /// \brief This type is neither copyable nor movable
+  concurrent_clock_cache(const concurrent_clock_cache &) = delete;
+  concurrent_clock_cache &operator=(const concurrent_clock_cache &) = delete;
+
+  /// \brief The number of entries currently in the cache. Only a snapshot,
+  /// if other threads modify the cache concurrently
+  size_t size() const noexcept {
+    return count.load(std::memory_order_relaxed);
+  }
+
+  /// \brief The maximum number of entries that can be cached at a time
+  size_t getLimit() const noexcept { return limit; }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true.
+  ///
+  /// If the limit is reached, the clock hand evicts an entry that has not
+  /// been accessed since the hand passed it the last time. If a concurrent
+  /// insertion of key wins, this one is treated as a later one.
+  /// \return True, iff the insertion actually took place
+  bool insert(const TKey &key, const TValue &value, bool update = false) {
+    auto hash = uint32_t(hasher(key));
+
+    // Update an existing entry
+    for (;;) {
+      uint64_t state = 0;
+      auto pos = probe(hash, [&](size_t pos) {
+        return readSlot(slots[pos], key, state).has_value();
+      });
+      if (pos > mask)
+        break;
+      if (!update)
+        return false;
+
+      auto &slot = slots[pos];
+      auto busy = nextVersion(state, Busy);
+      if (!slot.state.compare_exchange_strong(state, busy,
+                                              std::memory_order_acquire))
+        continue;
+
+      slot.value.store(value);
+      slot.referenced.store(1, std::memory_order_relaxed);
+      slot.state.store(nextVersion(busy, Ready), std::memory_order_release);
+      return true;
+    }
+
+    if (reserved.fetch_add(1, std::memory_order_relaxed) >= limit)
+      evictOne();
+
+    // Claim the first empty slot of the probe sequence and mark all slots
+    // before as passed
+    auto pos = hash & mask;
+    for (size_t i = 0; i <= mask; ++i, pos = (pos + 1) & mask) {
+      auto &slot = slots[pos];
+      auto state = slot.state.load(std::memory_order_relaxed);
+      if ((state & StateMask) == Empty) {
+        auto busy = nextVersion(state, Busy);
+        if (slot.state.compare_exchange_strong(state, busy,
+                                               std::memory_order_acquire)) {
+          slot.hash = hash;
+          slot.key.store(key);
+          slot.value.store(value);
+          slot.referenced.store(0, std::memory_order_relaxed);
+          slot.state.store(nextVersion(busy, Ready), std::memory_order_release);
+          count.fetch_add(1, std::memory_order_relaxed);
+          if (retireDuplicates(hash, key, pos))
+            return true;
+          return update && insert(key, value, true);
+        }
+      }
+      slot.displacements.fetch_add(1, std::memory_order_release);
+    }
+
+    // Unreachable as long as fewer threads insert concurrently than the limit
+    for (size_t i = 0; i <= mask; ++i)
+      slots[(hash + i) & mask].displacements.fetch_sub(
+          1, std::memory_order_release);
+    reserved.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  /// \brief Looks up the value associated to key in the cache. Sets the
+  /// reference bit of the entry.
+  /// \return A copy of the cached value associated with key if found. Returns
+  /// std::nullopt, iff key is not present in the cache.
+  std::optional<TValue> get(const TKey &key) {
+    std::optional<TValue> ret;
+    auto hash = uint32_t(hasher(key));
+    auto pos = probe(hash, [&](size_t pos) {
+      uint64_t state;
+      ret = readSlot(slots[pos], key, state);
+      return ret.has_value();
+    });
+
+    // Avoid writing the shared cache line, if the bit is already set
+    if (ret && !slots[pos].referenced.load(std::memory_order_relaxed))
+      slots[pos].referenced.store(1, std::memory_order_relaxed);
+    return ret;
+  }
+
+  /// \brief Same as get(const TKey&), but without setting the reference bit.
+  std::optional<TValue> peek(const TKey &key) const {
+    std::optional<TValue> ret;
+    probe(uint32_t(hasher(key)), [&](size_t pos) {
+      uint64_t state;
+      ret = readSlot(slots[pos], key, state);
+      return ret.has_value();
+    });
+    return ret;
+  }
+
+  /// \brief Removes the entries associated with key from the cache, if any.
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) {
+    bool erased = false;
+    probe(uint32_t(hasher(key)), [&](size_t pos) {
+      for (;;) {
+        uint64_t state;
+        if (!readSlot(slots[pos], key, state))
+          return false;
+
+        auto busy = nextVersion(state, Busy);
+        if (slots[pos].state.compare_exchange_strong(
+                state, busy, std::memory_order_acquire)) {
+          removeOwned(pos, busy);
+          erased = true;
+          return false;
+        }
+      }
+    });
+    return erased;
+  }
+
+  /// \brief Removes all entries from the cache. Entries that are inserted
+  /// concurrently may remain.
+  void clear() noexcept {
+    for (size_t pos = 0; pos <= mask; ++pos) {
+      auto &slot = slots[pos];
+      for (;;) {
+        auto state = loadStable(slot);
+        if (!isReady(state))
+          break;
+
+        auto busy = nextVersion(state, Busy);
+        if (slot.state.compare_exchange_strong(state, busy,
+                                               std::memory_order_acquire)) {
+          removeOwned(pos, busy);
+          break;
+        }
+      }
+    }
+  }
+
+  /// \brief Calls fn(key, value) for a consistent copy of each entry in the
+  /// cache in slot order. Entries that are modified concurrently may be
+  /// skipped or visited with their old or new value.
+  template <typename Fn> void forEach(Fn &&fn) const {
+    for (size_t pos = 0; pos <= mask; ++pos) {
+      auto &slot = slots[pos];
+      for (;;) {
+        auto state = loadStable(slot);
+        if (!isReady(state))
+          break;
+
+        auto key = slot.key.load();
+        auto value = slot.value.load();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.state.load(std::memory_order_relaxed) == state) {
+          fn(key, value);
+          break;
+        }
+      }
+    }
+  }
+};
+} // namespace caching
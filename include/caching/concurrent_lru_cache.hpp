@@ -0,0 +1,541 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+
+#include "caching/hash.hpp"
+#include "caching/maintenance_executor.hpp"
+#include "caching/seqlock_cell.hpp"
+
+namespace caching {
+
+///
+/// \brief A thread-safe LRU cache for read-mostly workloads. Keys and values
+/// must be trivially copyable and default constructible.
+///
+/// The cache is split into shards with a fixed capacity each. Writers
+/// (insert, erase, clear) lock their shard. Readers (get, peek) take no lock:
+/// They probe the shard's open-addressing index, copy the entry optimistically
+/// and validate the copy against the shard's sequence counter, which writers
+/// increment before and after each modification. Only if the shard is modified
+/// repeatedly during a read, the reader falls back to the lock.
+///
+/// Since lock-free readers cannot reorder the LRU list, get() records a sample
+/// of its hits in a small lossy per-shard buffer. The buffer is drained under
+/// the shard lock before the next write, which then evicts in (approximate)
+/// LRU order. Hence, reads never write to the shared index or list.
+///
+/// Optionally, a maintenance_executor evicts in the background: Then each
+/// shard has some headroom above its share of the limit, insertions only
+/// schedule the maintenance of their shard and the executor drains the read
+/// buffer and evicts down to the limit in bounded batches. Only if a shard
+/// runs out of headroom, because the maintenance falls behind, the inserting
+/// thread evicts itself.
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam TValue The type of cached values
+/// \tparam THash The hash function. The lower 32 bits select the index slot
+/// and, after mixing, the shard
+/// \tparam TKeyEqual The key comparison function
+template <typename TKey, typename TValue, typename THash = hash<TKey>,
+          typename TKeyEqual = std::equal_to<TKey>>
+class concurrent_lru_cache {
+  static_assert(std::is_trivially_copyable_v<TKey> &&
+                    std::is_trivially_copyable_v<TValue>,
+                "concurrent_lru_cache requires trivially copyable keys and "
+                "values");
+
+public:
+  /// The number of optimistic attempts of a read, before it locks the shard
+  static constexpr unsigned MaxOptimisticReads = 4;
+  /// The number of entries of the per-shard buffer of recorded hits
+  static constexpr unsigned ReadBufferSize = 16;
+  /// get() records one in RecencySampleRate hits on average
+  static constexpr unsigned RecencySampleRate = 4;
+  /// The maximum number of evictions of one background maintenance task
+  static constexpr unsigned MaintenanceBatch = 64;
+
+private:
+  using index_type = uint32_t;
+  static constexpr index_type Nil = ~index_type(0);
+
+  struct Node {
+    detail::seqlock_cell<TKey> key;
+    detail::seqlock_cell<TValue> value;
+    // The following fields are only accessed under the shard lock
+    uint32_t hash = 0;
+    index_type prev = Nil;
+    /// The next node in LRU order, or in the freelist
+    index_type next = Nil;
+    bool used = false;
+  };
+
+  struct alignas(64) Shard {
+    /// Odd while a writer modifies the index or the entries
+    std::atomic<uint64_t> seq{0};
+    /// Each slot holds (hash << 32) | (node + 1), or 0 if it is empty. The
+    /// number of slots is a power of two and at least twice the capacity
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    std::unique_ptr<Node[]> nodes;
+    index_type slotMask = 0;
+    /// The number of nodes
+    index_type capacity = 0;
+    /// The number of entries to evict down to. Less than capacity if the
+    /// shard is maintained in the background
+    index_type target = 0;
+
+    /// Nodes+1 of recently hit entries, or 0. Written by readers without
+    /// synchronization, hence on its own cache line
+    alignas(64) std::atomic<index_type> readBuffer[ReadBufferSize] = {};
+
+    alignas(64) std::mutex mutex;
+    /// Least recently used entry
+    index_type head = Nil;
+    /// Most recently used entry
+    index_type tail = Nil;
+    index_type freeList = Nil;
+    /// The number of nodes that have ever been used since the last clear
+    index_type numAllocated = 0;
+    std::atomic<size_t> count{0};
+    /// True, iff a maintenance task for this shard is scheduled
+    bool maintenancePending = false;
+  };
+
+  std::unique_ptr<Shard[]> shards;
+  size_t numShards;
+  unsigned shardBits;
+  size_t limit;
+  maintenance_executor *executor;
+
+  THash hasher;
+  TKeyEqual keyEqual;
+
+  static uint64_t makeSlot(uint32_t hash, index_type node) noexcept {
+    return (uint64_t(hash) << 32) | (uint64_t(node) + 1);
+  }
+  static uint32_t slotHash(uint64_t slot) noexcept {
+    return uint32_t(slot >> 32);
+  }
+  static index_type slotNode(uint64_t slot) noexcept {
+    return index_type(slot) - 1;
+  }
+
+  Shard &shardOf(uint32_t hash) const noexcept {
+    // Mix the hash, such that the shard does not correlate with the slot
+    auto idx = shardBits ? (hash * 0x9E3779B1u) >> (32 - shardBits) : 0;
+    return shards[idx];
+  }
+
+  /// Searches key in the index of sh. Only uses atomic loads, so it may run
+  /// concurrently to a writer; The result is only valid if the writer did not
+  /// modify sh meanwhile.
+  index_type find(const Shard &sh, const TKey &key,
+                  uint32_t hash) const noexcept {
+    auto pos = hash & sh.slotMask;
+    // Bounded, since a concurrent writer may shuffle the slots
+    for (index_type i = 0; i <= sh.slotMask; ++i) {
+      auto slot = sh.slots[pos].load(std::memory_order_relaxed);
+      if (!slot)
+        return Nil;
+
+      auto node = slotNode(slot);
+      if (slotHash(slot) == hash && node < sh.capacity &&
+          keyEqual(sh.nodes[node].key.load(), key))
+        return node;
+      pos = (pos + 1) & sh.slotMask;
+    }
+    return Nil;
+  }
+
+  static void beginWrite(Shard &sh) noexcept {
+    auto seq = sh.seq.load(std::memory_order_relaxed);
+    sh.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  static void endWrite(Shard &sh) noexcept {
+    auto seq = sh.seq.load(std::memory_order_relaxed);
+    sh.seq.store(seq + 1, std::memory_order_release);
+  }
+
+  /// Runs read on sh without locking, until it observes a consistent state.
+  /// Falls back to locking sh after MaxOptimisticReads failed attempts.
+  template <typename ReadFn>
+  auto optimisticRead(Shard &sh, ReadFn &&read) const -> decltype(read()) {
+    for (unsigned attempt = 0; attempt < MaxOptimisticReads; ++attempt) {
+      auto seq = sh.seq.load(std::memory_order_acquire);
+      if (seq & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      auto ret = read();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sh.seq.load(std::memory_order_relaxed) == seq)
+        return ret;
+    }
+
+    std::lock_guard lck(sh.mutex);
+    return read();
+  }
+
+  /// Records a hit of node in the read buffer of sh, if it is sampled
+  static void recordHit(Shard &sh, index_type node) noexcept {
+    static thread_local uint32_t rng =
+        uint32_t(reinterpret_cast<uintptr_t>(&rng)) | 1;
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    if (rng % RecencySampleRate)
+      return;
+
+    sh.readBuffer[(rng / RecencySampleRate) % ReadBufferSize].store(
+        node + 1, std::memory_order_relaxed);
+  }
+
+  static void unlinkList(Shard &sh, index_type i) noexcept {
+    auto &nod = sh.nodes[i];
+    if (nod.prev != Nil)
+      sh.nodes[nod.prev].next = nod.next;
+    else
+      sh.head = nod.next;
+
+    if (nod.next != Nil)
+      sh.nodes[nod.next].prev = nod.prev;
+    else
+      sh.tail = nod.prev;
+  }
+
+  static void pushBack(Shard &sh, index_type i) noexcept {
+    auto &nod = sh.nodes[i];
+    nod.prev = sh.tail;
+    nod.next = Nil;
+    if (sh.tail != Nil)
+      sh.nodes[sh.tail].next = i;
+    else
+      sh.head = i;
+    sh.tail = i;
+  }
+
+  static void touch(Shard &sh, index_type i) noexcept {
+    if (sh.tail != i) {
+      unlinkList(sh, i);
+      pushBack(sh, i);
+    }
+  }
+
+  /// Applies the hits recorded by lock-free readers to the LRU order. Must
+  /// hold the lock of sh.
+  static void drainReadBuffer(Shard &sh) noexcept {
+    for (auto &rec : sh.readBuffer) {
+      if (rec.load(std::memory_order_relaxed) == 0)
+        continue;
+      auto node = rec.exchange(0, std::memory_order_relaxed);
+      // The node may have been reused for another key since. This only
+      // perturbs the LRU order, which is approximate anyway.
+      if (node && sh.nodes[node - 1].used)
+        touch(sh, node - 1);
+    }
+  }
+
+  /// Removes the slot of node i by shifting back the following slots of its
+  /// probe sequence. Must be inside a write section of sh.
+  static void eraseSlot(Shard &sh, index_type i) noexcept {
+    auto hole = sh.nodes[i].hash & sh.slotMask;
+    while (slotNode(sh.slots[hole].load(std::memory_order_relaxed)) != i)
+      hole = (hole + 1) & sh.slotMask;
+
+    for (auto pos = (hole + 1) & sh.slotMask;; pos = (pos + 1) & sh.slotMask) {
+      auto slot = sh.slots[pos].load(std::memory_order_relaxed);
+      if (!slot)
+        break;
+
+      auto home = slotHash(slot) & sh.slotMask;
+      bool movable = hole <= pos ? (home <= hole || home > pos)
+                                 : (home <= hole && home > pos);
+      if (movable) {
+        sh.slots[hole].store(slot, std::memory_order_relaxed);
+        hole = pos;
+      }
+    }
+    sh.slots[hole].store(0, std::memory_order_relaxed);
+  }
+
+  static void insertSlot(Shard &sh, uint32_t hash, index_type i) noexcept {
+    auto pos = hash & sh.slotMask;
+    while (sh.slots[pos].load(std::memory_order_relaxed))
+      pos = (pos + 1) & sh.slotMask;
+    sh.slots[pos].store(makeSlot(hash, i), std::memory_order_relaxed);
+  }
+
+  /// Removes node i from the index and the LRU list and puts it on the
+  /// freelist. Must hold the lock of sh.
+  static void removeNode(Shard &sh, index_type i) noexcept {
+    beginWrite(sh);
+    eraseSlot(sh, i);
+    endWrite(sh);
+
+    unlinkList(sh, i);
+    sh.nodes[i].used = false;
+    sh.nodes[i].next = sh.freeList;
+    sh.freeList = i;
+    sh.count.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /// Schedules the background maintenance of sh, if it is not scheduled yet.
+  /// Must hold the lock of sh.
+  void scheduleMaintenance(Shard &sh) {
+    if (sh.maintenancePending)
+      return;
+    sh.maintenancePending = true;
+    executor->submit([this, &sh] { maintain(sh); });
+  }
+
+  /// Drains the read buffer of sh and evicts at most MaintenanceBatch entries
+  /// towards its target. Reschedules itself, if that is not enough.
+  void maintain(Shard &sh) {
+    std::lock_guard lck(sh.mutex);
+    drainReadBuffer(sh);
+    for (unsigned n = 0; n < MaintenanceBatch &&
+                         sh.count.load(std::memory_order_relaxed) > sh.target;
+         ++n)
+      removeNode(sh, sh.head);
+
+    if (sh.count.load(std::memory_order_relaxed) > sh.target)
+      executor->submit([this, &sh] { maintain(sh); });
+    else
+      sh.maintenancePending = false;
+  }
+
+  static size_t defaultNumShards() noexcept {
+    auto threads = std::thread::hardware_concurrency();
+    return threads ? 4 * size_t(threads) : 16;
+  }
+
+public:
+  /// \brief Initializes a new, empty concurrent_lru_cache
+  /// \param limit The maximum number of elements that can be cached at a time
+  /// \param numShards The number of independently locked shards. Rounded up
+  /// to a power of two and at most limit. By default 4 times the number of
+  /// hardware threads
+  /// \param executor The executor for the background maintenance, or null to
+  /// evict in the inserting threads. Must outlive this cache
+  explicit concurrent_lru_cache(size_t limit,
+                                size_t numShards = defaultNumShards(),
+                                maintenance_executor *executor = nullptr)
+      : limit(limit), executor(executor) {
+    assert(limit && limit < Nil && "Invalid cache-limit");
+    if (numShards > limit)
+      numShards = limit;
+
+    shardBits = 0;
+    while ((size_t(1) << shardBits) < numShards)
+      ++shardBits;
+    this->numShards = size_t(1) << shardBits;
+
+    // Each shard has the same capacity, so the total capacity may slightly
+    // exceed the limit
+    auto target = index_type((limit + this->numShards - 1) / this->numShards);
+    // Leave headroom for the insertions until the maintenance catches up
+    auto capacity = executor ? target + std::max<index_type>(1, target / 4)
+                             : target;
+    index_type numSlots = 4;
+    while (numSlots < 2 * capacity)
+      numSlots <<= 1;
+
+    shards = std::make_unique<Shard[]>(this->numShards);
+    for (size_t i = 0; i < this->numShards; ++i) {
+      auto &sh = shards[i];
+      sh.capacity = capacity;
+      sh.target = target;
+      sh.slotMask = numSlots - 1;
+      sh.nodes = std::make_unique<Node[]>(capacity);
+      sh.slots = std::make_unique<std::atomic<uint64_t>[]>(numSlots);
+    }
+  }
+
+  /// \brief Waits for the scheduled maintenance of all shards
+  ~concurrent_lru_cache() {
+    if (!executor)
+      return;
+
+    for (size_t i = 0; i < numShards; ++i) {
+      for (;;) {
+        {
+          std::lock_guard lck(shards[i].mutex);
+          if (!shards[i].maintenancePending)
+            break;
+        }
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  /// \brief This type is neither copyable nor movable
+  concurrent_lru_cache(const concurrent_lru_cache &) = delete;
+  concurrent_lru_cache &operator=(const concurrent_lru_cache &) = delete;
+
+  /// \brief The number of entries currently in the cache. Only a snapshot,
+  /// if other threads modify the cache concurrently
+  size_t size() const noexcept {
+    size_t ret = 0;
+    for (size_t i = 0; i < numShards; ++i)
+      ret += shards[i].count.load(std::memory_order_relaxed);
+    return ret;
+  }
+
+  /// \brief The maximum number of entries that can be cached at a time
+  size_t getLimit() const noexcept { return limit; }
+
+  /// \brief The number of shards
+  size_t shardCount() const noexcept { return numShards; }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true.
+  ///
+  /// If the shard of key is full, its least recently used entry is replaced.
+  /// With a maintenance_executor, the shard is full only if the background
+  /// eviction falls behind.
+  /// \return True, iff the insertion actually took place
+  bool insert(const TKey &key, const TValue &value, bool update = false) {
+    auto hash = uint32_t(hasher(key));
+    auto &sh = shardOf(hash);
+    std::lock_guard lck(sh.mutex);
+    if (!executor)
+      drainReadBuffer(sh);
+
+    if (auto i = find(sh, key, hash); i != Nil) {
+      touch(sh, i);
+      if (update) {
+        beginWrite(sh);
+        sh.nodes[i].value.store(value);
+        endWrite(sh);
+      }
+      return false;
+    }
+
+    beginWrite(sh);
+    index_type i;
+    if (sh.freeList != Nil) {
+      i = sh.freeList;
+      sh.freeList = sh.nodes[i].next;
+      sh.count.fetch_add(1, std::memory_order_relaxed);
+    } else if (sh.numAllocated < sh.capacity) {
+      i = sh.numAllocated++;
+      sh.count.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      // Recycle the least recently used node
+      if (executor)
+        drainReadBuffer(sh);
+      i = sh.head;
+      eraseSlot(sh, i);
+      unlinkList(sh, i);
+    }
+
+    auto &nod = sh.nodes[i];
+    nod.key.store(key);
+    nod.value.store(value);
+    nod.hash = hash;
+    nod.used = true;
+    insertSlot(sh, hash, i);
+    endWrite(sh);
+
+    pushBack(sh, i);
+    if (executor && sh.count.load(std::memory_order_relaxed) > sh.target)
+      scheduleMaintenance(sh);
+    return true;
+  }
+
+  /// \brief Looks up the value associated to key in the cache without
+  /// locking. Records the hit for the LRU order.
+  /// \return A copy of the cached value associated with key if found. Returns
+  /// std::nullopt, iff key is not present in the cache.
+  std::optional<TValue> get(const TKey &key) const {
+    auto hash = uint32_t(hasher(key));
+    auto &sh = shardOf(hash);
+
+    index_type node = Nil;
+    auto ret = optimisticRead(sh, [&]() -> std::optional<TValue> {
+      node = find(sh, key, hash);
+      if (node == Nil)
+        return std::nullopt;
+      return sh.nodes[node].value.load();
+    });
+
+    if (ret)
+      recordHit(sh, node);
+    return ret;
+  }
+
+  /// \brief Same as get(const TKey&), but without affecting the LRU order.
+  std::optional<TValue> peek(const TKey &key) const {
+    auto hash = uint32_t(hasher(key));
+    auto &sh = shardOf(hash);
+    return optimisticRead(sh, [&]() -> std::optional<TValue> {
+      auto node = find(sh, key, hash);
+      if (node == Nil)
+        return std::nullopt;
+      return sh.nodes[node].value.load();
+    });
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) {
+    auto hash = uint32_t(hasher(key));
+    auto &sh = shardOf(hash);
+    std::lock_guard lck(sh.mutex);
+    if (!executor)
+      drainReadBuffer(sh);
+
+    auto i = find(sh, key, hash);
+    if (i == Nil)
+      return false;
+
+    removeNode(sh, i);
+    return true;
+  }
+
+  /// \brief Removes all entries from the cache
+  void clear() {
+    for (size_t s = 0; s < numShards; ++s) {
+      auto &sh = shards[s];
+      std::lock_guard lck(sh.mutex);
+      for (auto &rec : sh.readBuffer)
+        rec.store(0, std::memory_order_relaxed);
+
+      beginWrite(sh);
+      for (index_type i = 0; i <= sh.slotMask; ++i)
+        sh.slots[i].store(0, std::memory_order_relaxed);
+      endWrite(sh);
+
+      for (index_type i = 0; i < sh.numAllocated; ++i)
+        sh.nodes[i].used = false;
+      sh.head = sh.tail = sh.freeList = Nil;
+      sh.numAllocated = 0;
+      sh.count.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /// \brief Iterates all entries in the cache, shard by shard, in LRU order
+  /// (least recently used first) and calls fn(key, value) for each entry.
+  /// Locks one shard at a time, so fn must not access this cache.
+  template <typename Fn> void forEach(Fn &&fn) {
+    for (size_t s = 0; s < numShards; ++s) {
+      auto &sh = shards[s];
+      std::lock_guard lck(sh.mutex);
+      drainReadBuffer(sh);
+      for (auto i = sh.head; i != Nil; i = sh.nodes[i].next)
+        fn(sh.nodes[i].key.load(), sh.nodes[i].value.load());
+    }
+  }
+};
+} // namespace caching
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "caching/concurrent_lru_cache.hpp"
+#include "caching/hash.hpp"
+
+namespace caching {
+
+///
+/// \brief A thread-safe cache that versions its entries, such that
+/// front_caches of individual threads can replicate hot entries.
+///
+/// Wraps a thread-safe cache and a table of version counters. Each key maps
+/// to one version counter by its hash (its stripe). Every modification of the
+/// shared cache, i.e. an insertion that took place or updated an entry, or an
+/// erasure, increments the version of the key's stripe after it modified the
+/// shared cache. A front_cache remembers the version of the stripe at the time it
+/// copied an entry and compares it on later hits. Since modifications are
+/// rare in read-mostly workloads, the version counters are mostly read and do
+/// not bounce between the cores.
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam TValue The type of cached values
+/// \tparam TSharedCache The wrapped thread-safe cache. Provides
+/// insert(key, value, update), erase(key), clear(), get(key) and peek(key),
+/// where get and peek return std::optional<TValue>
+/// \tparam THash The hash function for the stripes and the front caches
+template <typename TKey, typename TValue,
+          typename TSharedCache = concurrent_lru_cache<TKey, TValue>,
+          typename THash = hash<TKey>>
+class versioned_cache {
+  TSharedCache cache;
+  std::unique_ptr<std::atomic<uint64_t>[]> versions;
+  unsigned stripeBits;
+  THash hasher;
+
+  void bump(uint64_t hash) noexcept {
+    versionOf(hash).fetch_add(1, std::memory_order_release);
+  }
+
+public:
+  /// \brief Initializes a new, empty versioned_cache
+  /// \param numStripes The number of version counters. Rounded up to a power
+  /// of two. More stripes invalidate fewer unrelated front cache entries per
+  /// modification
+  /// \param args The arguments for the constructor of the shared cache
+  template <typename... Args>
+  explicit versioned_cache(size_t numStripes, Args &&...args)
+      : cache(std::forward<Args>(args)...) {
+    assert(numStripes && "There must be at least one stripe");
+    stripeBits = 0;
+    while ((size_t(1) << stripeBits) < numStripes)
+      ++stripeBits;
+    versions = std::make_unique<std::atomic<uint64_t>[]>(size_t(1)
+                                                          << stripeBits);
+  }
+
+  /// \brief The version counter of the stripe of the given hash
+  std::atomic<uint64_t> &versionOf(uint64_t hash) const noexcept {
+    auto idx = stripeBits ? (uint32_t(hash) * 0x9E3779B1u) >> (32 - stripeBits)
+                          : 0;
+    return versions[idx];
+  }
+
+  /// \brief The wrapped cache. Modifications must go through this
+  /// versioned_cache to keep the front caches coherent.
+  const TSharedCache &shared() const noexcept { return cache; }
+
+  /// \brief The number of entries currently in the shared cache
+  size_t size() const noexcept { return cache.size(); }
+
+  /// \brief Inserts the (key, value) pair into the shared cache, if there is
+  /// no other entry with an equivalent key or if update is true.
+  /// \return True, iff the insertion actually took place
+  bool insert(const TKey &key, const TValue &value, bool update = false) {
+    auto ret = cache.insert(key, value, update);
+    if (ret || update)
+      bump(hasher(key));
+    return ret;
+  }
+
+  /// \brief Looks up the value associated to key in the shared cache
+  std::optional<TValue> get(const TKey &key) { return cache.get(key); }
+
+  /// \brief Same as get(const TKey&), but without affecting the replacement
+  /// order
+  std::optional<TValue> peek(const TKey &key) const { return cache.peek(key); }
+
+  /// \brief Removes the entry associated with key from the shared cache, if
+  /// any.
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) {
+    auto ret = cache.erase(key);
+    if (ret)
+      bump(hasher(key));
+    return ret;
+  }
+
+  /// \brief Removes all entries from the shared cache and invalidates all
+  /// front caches
+  void clear() {
+    cache.clear();
+    for (size_t i = 0, n = size_t(1) << stripeBits; i < n; ++i)
+      versions[i].fetch_add(1, std::memory_order_release);
+  }
+};
+
+///
+/// \brief A small direct-mapped cache, that a single thread consults before
+/// a shared versioned_cache. Turns lookups of the hottest keys into
+/// thread-local hits. This cache is not thread-safe; Each thread creates its
+/// own front_cache for the same versioned_cache.
+///
+/// A front_cache never serves an entry that has been modified through the
+/// versioned_cache longer than maxStaleness ago. With the default
+/// maxStaleness of zero, every hit compares the version of the entry's
+/// stripe, so modifications are visible as soon as they complete. Otherwise,
+/// hits skip this comparison for maxStaleness after the last one.
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam TValue The type of cached values
+/// \tparam TSharedCache The wrapped thread-safe cache of the versioned_cache
+/// \tparam THash The hash function of the versioned_cache
+/// \tparam TKeyEqual The key comparison function
+template <typename TKey, typename TValue,
+          typename TSharedCache = concurrent_lru_cache<TKey, TValue>,
+          typename THash = hash<TKey>, typename TKeyEqual = std::equal_to<TKey>>
+class front_cache {
+public:
+  using shared_type = versioned_cache<TKey, TValue, TSharedCache, THash>;
+  using clock = std::chrono::steady_clock;
+
+private:
+  struct Slot {
+    std::optional<std::pair<TKey, TValue>> entry;
+    /// The version of the stripe of the entry, when it was copied or last
+    /// compared
+    uint64_t version = 0;
+    clock::time_point validatedAt;
+  };
+
+  shared_type &owner;
+  std::vector<Slot> slots;
+  clock::duration maxStaleness;
+
+  THash hasher;
+  TKeyEqual keyEqual;
+
+  size_t numHits = 0;
+  size_t numMisses = 0;
+
+  Slot &slotOf(uint64_t hash) noexcept {
+    return slots[hash & (slots.size() - 1)];
+  }
+
+  bool isFresh(Slot &slot, const std::atomic<uint64_t> &version) const {
+    if (maxStaleness == clock::duration::zero())
+      return version.load(std::memory_order_acquire) == slot.version;
+
+    auto now = clock::now();
+    if (now - slot.validatedAt <= maxStaleness)
+      return true;
+    if (version.load(std::memory_order_acquire) != slot.version)
+      return false;
+    slot.validatedAt = now;
+    return true;
+  }
+
+public:
+  /// \brief Initializes a new, empty front_cache for owner
+  /// \param numSlots The number of entries. Rounded up to a power of two
+  /// \param maxStaleness How long modifications of entries may remain
+  /// invisible to this front cache
+  explicit front_cache(shared_type &owner, size_t numSlots = 64,
+                       clock::duration maxStaleness = clock::duration::zero())
+      : owner(owner), maxStaleness(maxStaleness) {
+    assert(numSlots && "There must be at least one slot");
+    size_t n = 1;
+    while (n < numSlots)
+      n <<= 1;
+    slots.resize(n);
+  }
+
+  /// \brief The number of lookups that this front cache served itself
+  size_t hits() const noexcept { return numHits; }
+
+  /// \brief The number of lookups that this front cache forwarded to the
+  /// shared cache
+  size_t misses() const noexcept { return numMisses; }
+
+  /// \brief Looks up the value associated to key in this front cache, or
+  /// otherwise in the shared cache and copies it into this front cache.
+  /// \return A copy of the cached value associated with key if found. Returns
+  /// std::nullopt, iff key is not present in the shared cache.
+  std::optional<TValue> get(const TKey &key) {
+    auto hash = hasher(key);
+    auto &slot = slotOf(hash);
+    auto &version = owner.versionOf(hash);
+    if (slot.entry && keyEqual(slot.entry->first, key) &&
+        isFresh(slot, version)) {
+      ++numHits;
+      return slot.entry->second;
+    }
+
+    ++numMisses;
+    // Read the version before the entry, such that a concurrent modification
+    // invalidates the copy
+    auto ver = version.load(std::memory_order_acquire);
+    auto ret = owner.get(key);
+    if (ret) {
+      slot.entry.emplace(key, *ret);
+      slot.version = ver;
+      if (maxStaleness != clock::duration::zero())
+        slot.validatedAt = clock::now();
+    } else if (slot.entry && keyEqual(slot.entry->first, key)) {
+      slot.entry.reset();
+    }
+    return ret;
+  }
+
+  /// \brief Inserts the (key, value) pair into the shared cache (see
+  /// versioned_cache::insert). Drops the copy of key from this front cache.
+  bool insert(const TKey &key, const TValue &value, bool update = false) {
+    invalidate(key);
+    return owner.insert(key, value, update);
+  }
+
+  /// \brief Removes the entry associated with key from the shared cache (see
+  /// versioned_cache::erase). Drops the copy of key from this front cache.
+  bool erase(const TKey &key) {
+    invalidate(key);
+    return owner.erase(key);
+  }
+
+  /// \brief Drops the copy of key from this front cache, if any
+  void invalidate(const TKey &key) {
+    auto &slot = slotOf(hasher(key));
+    if (slot.entry && keyEqual(slot.entry->first, key))
+      slot.entry.reset();
+  }
+
+  /// \brief Drops all copies from this front cache
+  void clear() noexcept {
+    for (auto &slot : slots)
+      slot.entry.reset();
+  }
+};
+} // namespace caching
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#if !defined(CACHING_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <immintrin.h>
+#define CACHING_HASH_SSE2 1
+#if defined(__AVX2__)
+#define CACHING_HASH_AVX2 1
+#endif
+#endif
+
+namespace caching {
+
+namespace detail {
+constexpr uint64_t HashSecret[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+                                    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+
+/// Secrets of the 8 accumulator lanes used for long inputs
+alignas(32) constexpr uint64_t StripeSecret[8] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL,
+    0x1f67b3b7a4a44072ULL, 0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL,
+    0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL};
+
+/// Multiplies a and b to 128 bits and folds the result to 64 bits
+constexpr uint64_t mum(uint64_t a, uint64_t b) noexcept {
+#if defined(__SIZEOF_INT128__)
+  auto r = static_cast<unsigned __int128>(a) * b;
+  return uint64_t(r) ^ uint64_t(r >> 64);
+#else
+  uint64_t ha = a >> 32, hb = b >> 32, la = uint32_t(a), lb = uint32_t(b);
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  return lo ^ hi;
+#endif
+}
+
+inline uint64_t read64(const uint8_t *p) noexcept {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+inline uint64_t read32(const uint8_t *p) noexcept {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/// Inputs longer than this are hashed by the (vectorized) stripe loop
+constexpr size_t LongInputThreshold = 256;
+constexpr size_t StripeSize = 64;
+
+/// Accumulates the 64-byte stripes of [p, p + numStripes * 64) into acc. Each
+/// lane i computes acc[i ^ 1] += d and acc[i] += lo32(d ^ s) * hi32(d ^ s),
+/// where d is the i-th 8 bytes of the stripe and s the secret of lane i.
+inline void accumulateStripes(uint64_t acc[8], const uint8_t *p,
+                              size_t numStripes) noexcept {
+#if defined(CACHING_HASH_AVX2)
+  __m256i vacc[2] = {_mm256_loadu_si256(reinterpret_cast<__m256i *>(acc)),
+                     _mm256_loadu_si256(reinterpret_cast<__m256i *>(acc + 4))};
+  const __m256i vsecret[2] = {
+      _mm256_load_si256(reinterpret_cast<const __m256i *>(StripeSecret)),
+      _mm256_load_si256(reinterpret_cast<const __m256i *>(StripeSecret + 4))};
+  for (size_t s = 0; s < numStripes; ++s, p += StripeSize) {
+    for (int j = 0; j < 2; ++j) {
+      auto data =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32 * j));
+      auto key = _mm256_xor_si256(data, vsecret[j]);
+      auto product = _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32));
+      // Swap the 64-bit lanes pairwise: lane i gets d of lane i ^ 1
+      auto swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+      vacc[j] = _mm256_add_epi64(vacc[j], _mm256_add_epi64(product, swapped));
+    }
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc), vacc[0]);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + 4), vacc[1]);
+#elif defined(CACHING_HASH_SSE2)
+  __m128i vacc[4];
+  __m128i vsecret[4];
+  for (int j = 0; j < 4; ++j) {
+    vacc[j] = _mm_loadu_si128(reinterpret_cast<__m128i *>(acc + 2 * j));
+    vsecret[j] =
+        _mm_load_si128(reinterpret_cast<const __m128i *>(StripeSecret + 2 * j));
+  }
+  for (size_t s = 0; s < numStripes; ++s, p += StripeSize) {
+    for (int j = 0; j < 4; ++j) {
+      auto data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * j));
+      auto key = _mm_xor_si128(data, vsecret[j]);
+      auto product = _mm_mul_epu32(key, _mm_srli_epi64(key, 32));
+      auto swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+      vacc[j] = _mm_add_epi64(vacc[j], _mm_add_epi64(product, swapped));
+    }
+  }
+  for (int j = 0; j < 4; ++j)
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + 2 * j), vacc[j]);
+#else
+  for (size_t s = 0; s < numStripes; ++s, p += StripeSize) {
+    for (int i = 0; i < 8; ++i) {
+      auto data = read64(p + 8 * i);
+      auto key = data ^ StripeSecret[i];
+      acc[i ^ 1] += data;
+      acc[i] += (key & 0xffffffff) * (key >> 32);
+    }
+  }
+#endif
+}
+
+inline uint64_t hashLong(const uint8_t *p, size_t len, uint64_t seed) noexcept {
+  uint64_t acc[8] = {seed,          HashSecret[0], HashSecret[1],
+                     HashSecret[2], HashSecret[3], seed ^ HashSecret[0],
+                     ~seed,         seed + len};
+  // The last stripe always covers the last 64 bytes, overlapping the previous
+  // stripe if len is not a multiple of 64
+  accumulateStripes(acc, p, (len - 1) / StripeSize);
+  accumulateStripes(acc, p + len - StripeSize, 1);
+
+  uint64_t ret = len * HashSecret[1];
+  for (int i = 0; i < 8; i += 2)
+    ret ^= mum(acc[i] ^ HashSecret[(i / 2) & 3], acc[i + 1] ^ seed);
+  return mum(ret ^ HashSecret[0], ret ^ HashSecret[3]);
+}
+} // namespace detail
+
+/// \brief Hashes len bytes at data. Short inputs use a wyhash-style
+/// multiply-fold, long inputs are accumulated in 64-byte stripes (vectorized
+/// with AVX2 or SSE2 where available, all paths compute the same result).
+/// The result depends on the endianness of the platform.
+inline uint64_t hashBytes(const void *data, size_t len,
+                          uint64_t seed = 0) noexcept {
+  using namespace detail;
+  auto *p = static_cast<const uint8_t *>(data);
+  seed ^= mum(seed ^ HashSecret[0], HashSecret[1]);
+
+  uint64_t a, b;
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (read32(p) << 32) | read32(p + ((len >> 3) << 2));
+      b = (read32(p + len - 4) << 32) | read32(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = (uint64_t(p[0]) << 16) | (uint64_t(p[len >> 1]) << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else if (len <= LongInputThreshold) {
+    size_t i = len;
+    if (i > 48) {
+      auto see1 = seed, see2 = seed;
+      do {
+        seed = mum(read64(p) ^ HashSecret[1], read64(p + 8) ^ seed);
+        see1 = mum(read64(p + 16) ^ HashSecret[2], read64(p + 24) ^ see1);
+        see2 = mum(read64(p + 32) ^ HashSecret[3], read64(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = mum(read64(p) ^ HashSecret[1], read64(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
+  } else {
+    return hashLong(p, len, seed);
+  }
+
+  a ^= HashSecret[1];
+  b ^= seed;
+  return mum(mum(a, b) ^ HashSecret[0] ^ len, b ^ HashSecret[1]);
+}
+
+/// \brief Mixes a 64-bit integer, such that all output bits depend on all
+/// input bits
+constexpr uint64_t hashInt(uint64_t x) noexcept {
+  return detail::mum(x ^ detail::HashSecret[0], detail::HashSecret[1]);
+}
+
+/// \brief Combines the hash of a value into the hash seed of preceding values.
+/// The result depends on the order of the combined hashes.
+constexpr uint64_t hashCombine(uint64_t seed, uint64_t value) noexcept {
+  return detail::mum(seed ^ detail::HashSecret[0],
+                     value ^ detail::HashSecret[3]);
+}
+
+///
+/// \brief A fast, high-quality hash function to use with the caches instead of
+/// std::hash.
+///
+/// std::hash is the identity for integers in common standard libraries, which
+/// degrades indices with a power-of-two number of buckets. This hash mixes
+/// integers with one multiplication and hashes strings with hashBytes(). For
+/// other types, the result of std::hash is mixed.
+template <typename T, typename = void> struct hash {
+  uint64_t operator()(const T &value) const
+      noexcept(noexcept(std::hash<T>{}(value))) {
+    return hashInt(uint64_t(std::hash<T>{}(value)));
+  }
+};
+
+template <typename T>
+struct hash<T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T> ||
+                                std::is_pointer_v<T>>> {
+  constexpr uint64_t operator()(T value) const noexcept {
+    if constexpr (std::is_pointer_v<T>)
+      return hashInt(uint64_t(reinterpret_cast<uintptr_t>(value)));
+    else
+      return hashInt(uint64_t(value));
+  }
+};
+
+/// \brief Strings are hashed by their characters. Supports heterogeneous
+/// lookup with any string type of the same character type.
+template <typename CharT, typename Traits, typename Alloc>
+struct hash<std::basic_string<CharT, Traits, Alloc>> {
+  using is_transparent = void;
+
+  uint64_t operator()(std::basic_string_view<CharT, Traits> value) const
+      noexcept {
+    return hashBytes(value.data(), value.size() * sizeof(CharT));
+  }
+};
+
+template <typename CharT, typename Traits>
+struct hash<std::basic_string_view<CharT, Traits>>
+    : hash<std::basic_string<CharT, Traits>> {};
+
+/// \brief Tuples combine the hashes of their elements with hashCombine().
+/// Supports heterogeneous lookup with tuples of references to the elements,
+/// such as the ones created by std::forward_as_tuple.
+template <typename... Ts> struct hash<std::tuple<Ts...>> {
+  using is_transparent = void;
+
+  template <typename... Us>
+  uint64_t operator()(const std::tuple<Us...> &value) const {
+    static_assert(sizeof...(Us) == sizeof...(Ts),
+                  "The tuple must have the same number of elements");
+    return combine(value, std::index_sequence_for<Ts...>{});
+  }
+
+private:
+  template <typename Tuple, size_t... Is>
+  static uint64_t combine(const Tuple &value, std::index_sequence<Is...>) {
+    uint64_t ret = detail::HashSecret[2];
+    ((ret = hashCombine(ret, hash<Ts>{}(std::get<Is>(value)))), ...);
+    return ret;
+  }
+};
+} // namespace caching
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <sstream>
+
+#include "caching/async_file_io.hpp"
+#include "caching/lru_cache.hpp"
+#include "caching/segment_log.hpp"
+
+namespace caching {
+
+///
+/// \brief A two-tier LRU cache: An in-memory lru_cache backed by a
+/// log-structured file tier (see segment_log). This cache is not thread-safe.
+///
+/// Entries evicted from the memory tier are not lost but demoted to the file
+/// tier. Lookups that miss the memory tier but hit the file tier promote the
+/// entry back into the memory tier (which may demote another entry). The file
+/// tier only reclaims space segment-wise in FIFO order, so its capacity is
+/// given in bytes rather than entries.
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam TValue The type of cached values
+/// \tparam KeySerializer Writes and reads keys to/from the file tier
+/// \tparam ValueSerializer Writes and reads values to/from the file tier
+template <typename TKey, typename TValue,
+          typename KeySerializer = serializer<TKey>,
+          typename ValueSerializer = serializer<TValue>>
+class hybrid_cache {
+  lru_cache<TKey, TValue> memory;
+  segment_log<TKey> disk;
+
+  std::ostringstream writeScratch;
+  std::string readScratch;
+
+  void demote(const TKey &key, TValue &&value) {
+    writeScratch.str(std::string());
+    KeySerializer::write(writeScratch, key);
+    ValueSerializer::write(writeScratch, value);
+    if (writeScratch)
+      disk.append(key, writeScratch.str());
+    writeScratch.clear();
+  }
+
+  /// Promotes the record of key that was read asynchronously from loc
+  std::optional<std::reference_wrapper<TValue>>
+  completeRead(const TKey &key, const typename segment_log<TKey>::location &loc,
+               int result, const std::string &record) {
+    // The entry may have been promoted or inserted in the meantime
+    if (auto ret = memory.get(key))
+      return ret;
+
+    auto cur = disk.locate(key);
+    if (!cur || cur->segment != loc.segment || cur->offset != loc.offset) {
+      // A newer record has been demoted since the read was queued
+      return get(key);
+    }
+
+    disk.erase(key);
+    if (result != int(loc.length))
+      return std::nullopt;
+
+    auto value = decode(key, record);
+    if (!value)
+      return std::nullopt;
+    return std::ref(*memory.insert(key, std::move(*value)).first);
+  }
+
+  /// Reads the record of key from the file tier and removes it from there
+  std::optional<TValue> take(const TKey &key) {
+    if (!disk.read(key, readScratch))
+      return std::nullopt;
+    disk.erase(key);
+    return decode(key, readScratch);
+  }
+
+public:
+  /// \brief Initializes a new, empty hybrid_cache
+  /// \param memoryLimit The maximum number of elements in the memory tier
+  /// \param directory The directory for the segment files of the file tier
+  /// \param segmentSize The size of a segment file in bytes
+  /// \param maxSegments The maximum number of segment files
+  /// \param writeBatchSize The number of bytes of demoted entries to collect
+  /// before writing them in one sequential write
+  /// \throws std::system_error if the file tier cannot be created
+  hybrid_cache(size_t memoryLimit, std::filesystem::path directory,
+               uint64_t segmentSize = 64 << 20, unsigned maxSegments = 16,
+               size_t writeBatchSize = 1 << 20)
+      : memory(memoryLimit),
+        disk(std::move(directory), segmentSize, maxSegments, writeBatchSize) {
+    memory.setEvictionHandler(
+        [this](const TKey &key, TValue &&value) {
+          demote(key, std::move(value));
+        });
+  }
+
+  /// \brief This type is neither copyable nor movable
+  hybrid_cache(const hybrid_cache &) = delete;
+  hybrid_cache &operator=(const hybrid_cache &) = delete;
+
+  /// \brief The number of entries in the memory tier
+  size_t memorySize() const noexcept { return memory.size(); }
+
+  /// \brief The number of entries in the file tier
+  size_t diskSize() const noexcept { return disk.size(); }
+
+  /// \brief Decodes a record of the file tier that was written for key.
+  /// \return The value, or std::nullopt if the record is malformed
+  static std::optional<TValue> decode(const TKey &key,
+                                      const std::string &record) {
+    std::istringstream is(record);
+    TKey storedKey{};
+    TValue value{};
+    if (!KeySerializer::read(is, storedKey) ||
+        !ValueSerializer::read(is, value) || !(storedKey == key))
+      return std::nullopt;
+    return value;
+  }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key in any tier or if update is true.
+  ///
+  /// An existing entry in the file tier is promoted to the memory tier.
+  /// \return A tuple, where the first element is a pointer to the cached value
+  /// and the second element denotes whether the insertion actually took place
+  template <typename K, typename V>
+  std::pair<TValue *, bool> insert(K &&key, V &&value, bool update = false) {
+    if (!memory.peek(key)) {
+      if (update) {
+        disk.erase(key);
+      } else if (auto stored = take(key)) {
+        auto [ptr, unused] =
+            memory.insert(std::forward<K>(key), std::move(*stored));
+        return {ptr, false};
+      }
+    }
+    return memory.insert(std::forward<K>(key), std::forward<V>(value), update);
+  }
+
+  /// \brief Looks up the value associated to key in both tiers. Updates the
+  /// LRU order and promotes entries from the file tier to the memory tier.
+  /// \return A mutable reference to the cached value associated with key if
+  /// found. Returns std::nullopt, iff key is not present in the cache.
+  std::optional<std::reference_wrapper<TValue>> get(const TKey &key) {
+    if (auto ret = memory.get(key))
+      return ret;
+
+    if (auto stored = take(key))
+      return std::ref(*memory.insert(key, std::move(*stored)).first);
+
+    return std::nullopt;
+  }
+
+  /// \brief Looks up the value associated to key like get(), but reads from
+  /// the file tier asynchronously.
+  ///
+  /// Memory hits, misses and records still in the write buffer complete
+  /// immediately. Otherwise, a read is queued on io, and the entry is
+  /// promoted to the memory tier when io.poll() reaps its completion. Queue
+  /// the reads of many misses before calling io.submit() once, to hand them
+  /// to the kernel as one batch.
+  /// \param key The key to search for
+  /// \param io The engine to queue the read on. Must be polled by the thread
+  /// that uses this cache
+  /// \param callback Invoked as callback(result) with the same result that
+  /// get() would return. The reference is valid until the next modification
+  /// of the cache
+  template <typename Fn>
+  void getAsync(const TKey &key, async_file_io &io, Fn &&callback) {
+    if (auto ret = memory.get(key))
+      return callback(ret);
+
+    auto loc = disk.locate(key);
+    if (!loc || disk.readBuffered(*loc, readScratch))
+      return callback(get(key));
+
+    auto fd = disk.pin(loc->segment);
+    io.read(fd, loc->offset, loc->length,
+            [this, key, loc = *loc, callback = std::forward<Fn>(callback)](
+                int result, std::string &&record) mutable {
+              disk.unpin(loc.segment);
+              callback(completeRead(key, loc, result, record));
+            });
+  }
+
+  /// \brief Removes the entry associated with key from both tiers.
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) {
+    bool inMemory = memory.erase(key);
+    return disk.erase(key) || inMemory;
+  }
+
+  /// \brief Removes all entries from both tiers
+  void clear() {
+    memory.clear();
+    disk.clear();
+  }
+
+  /// \brief Writes all demoted entries that are still buffered to disk
+  bool flush() { return disk.flush(); }
+};
+} // namespace caching
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace caching {
+
+///
+/// \brief An append-only byte arena with size-class freelists.
+///
+/// Blocks are carved from one contiguous buffer and referred to by their
+/// offset, which stays valid when the buffer grows. Freed blocks are kept in
+/// a freelist per power-of-two size class and reused by later allocations of
+/// the same class, so a cache with a stable key size distribution stops
+/// growing the arena after warm-up.
+class byte_arena {
+  static constexpr uint64_t Nil = ~uint64_t(0);
+  static constexpr unsigned MinClassBits = 4;
+
+  std::vector<char> buffer;
+  /// The head of the freelist per size class. The first 8 bytes of a free
+  /// block hold the offset of the next free block.
+  std::vector<uint64_t> freeLists;
+
+  static unsigned classOf(size_t n) noexcept {
+    unsigned bits = MinClassBits;
+    while ((size_t(1) << bits) < n)
+      ++bits;
+    return bits - MinClassBits;
+  }
+
+public:
+  /// \brief The number of bytes a block for n bytes actually occupies
+  static size_t blockSize(size_t n) noexcept {
+    return size_t(1) << (classOf(n) + MinClassBits);
+  }
+
+  /// \brief Allocates a block for n bytes.
+  /// \return The offset of the block
+  uint64_t allocate(size_t n) {
+    auto cls = classOf(n);
+    if (cls >= freeLists.size())
+      freeLists.resize(cls + 1, Nil);
+
+    if (auto ret = freeLists[cls]; ret != Nil) {
+      std::memcpy(&freeLists[cls], &buffer[ret], sizeof(uint64_t));
+      return ret;
+    }
+
+    uint64_t ret = buffer.size();
+    buffer.resize(ret + (size_t(1) << (cls + MinClassBits)));
+    return ret;
+  }
+
+  /// \brief Returns the block at offset, that was allocated for n bytes, to
+  /// its freelist
+  void deallocate(uint64_t offset, size_t n) noexcept {
+    auto cls = classOf(n);
+    assert(cls < freeLists.size() && "The block was not allocated here");
+    std::memcpy(&buffer[offset], &freeLists[cls], sizeof(uint64_t));
+    freeLists[cls] = offset;
+  }
+
+  /// \brief The bytes of the block at offset. Only valid until the next
+  /// allocation.
+  char *data(uint64_t offset) noexcept { return buffer.data() + offset; }
+  const char *data(uint64_t offset) const noexcept {
+    return buffer.data() + offset;
+  }
+
+  /// \brief Frees all blocks. The memory is kept for reuse.
+  void clear() noexcept {
+    buffer.clear();
+    freeLists.clear();
+  }
+
+  /// \brief The number of bytes reserved by this arena
+  size_t capacity() const noexcept { return buffer.capacity(); }
+};
+
+///
+/// \brief A compact string handle for keys stored in a byte_arena.
+///
+/// Strings of up to 12 bytes are stored inline. Longer strings store their
+/// first 4 bytes inline as prefix and the offset of their bytes in the arena,
+/// so most comparisons of non-equal keys fail without touching the arena.
+struct arena_string {
+  static constexpr size_t InlineCapacity = 12;
+
+  uint32_t length = 0;
+  union {
+    char inlineData[InlineCapacity];
+    struct {
+      char prefix[4];
+      /// Split into two halves to keep the alignment at 4 bytes
+      uint32_t offset[2];
+    } external;
+  };
+
+  arena_string() noexcept : inlineData{} {}
+
+  bool isInline() const noexcept { return length <= InlineCapacity; }
+
+  uint64_t offset() const noexcept {
+    return uint64_t(external.offset[0]) | uint64_t(external.offset[1]) << 32;
+  }
+  void setOffset(uint64_t offset) noexcept {
+    external.offset[0] = uint32_t(offset);
+    external.offset[1] = uint32_t(offset >> 32);
+  }
+};
+static_assert(sizeof(arena_string) == 16,
+              "arena_string should fit into 16 bytes");
+
+///
+/// \brief Key storage policy of compact_lru_cache that stores the keys
+/// themselves in the nodes
+template <typename TKey, typename TKeyEqual = std::equal_to<TKey>>
+struct inline_key_storage {
+  using stored_type = TKey;
+  using lookup_type = TKey;
+
+  TKeyEqual keyEqual;
+
+  template <typename K> stored_type store(K &&key) {
+    return stored_type(std::forward<K>(key));
+  }
+  void release(stored_type &) noexcept {}
+  void clear() noexcept {}
+
+  bool equals(const stored_type &stored, const lookup_type &key) const {
+    return keyEqual(stored, key);
+  }
+  const TKey &view(const stored_type &stored) const noexcept { return stored; }
+
+  size_t memoryUsage() const noexcept { return 0; }
+};
+
+///
+/// \brief Key storage policy of compact_lru_cache that copies variable-length
+/// keys into a byte_arena owned by the cache.
+///
+/// Each node stores a 16-byte arena_string instead of e.g. an std::string, so
+/// inserting and evicting keys does not allocate or free heap memory once the
+/// arena is warmed up, and the key bytes are packed densely. Lookups take
+/// std::string_view, so callers do not need to construct std::string keys.
+struct arena_key_storage {
+  using stored_type = arena_string;
+  using lookup_type = std::string_view;
+
+  byte_arena arena;
+
+  stored_type store(std::string_view key) {
+    assert(key.size() <= UINT32_MAX && "The key is too long");
+    arena_string ret;
+    ret.length = uint32_t(key.size());
+    if (ret.isInline()) {
+      std::memcpy(ret.inlineData, key.data(), key.size());
+    } else {
+      std::memcpy(ret.external.prefix, key.data(), 4);
+      ret.setOffset(arena.allocate(key.size()));
+      std::memcpy(arena.data(ret.offset()), key.data(), key.size());
+    }
+    return ret;
+  }
+
+  void release(stored_type &stored) noexcept {
+    if (!stored.isInline())
+      arena.deallocate(stored.offset(), stored.length);
+    stored.length = 0;
+  }
+
+  void clear() noexcept { arena.clear(); }
+
+  bool equals(const stored_type &stored, std::string_view key) const noexcept {
+    if (stored.length != key.size())
+      return false;
+    if (stored.isInline())
+      return std::memcmp(stored.inlineData, key.data(), key.size()) == 0;
+    return std::memcmp(stored.external.prefix, key.data(), 4) == 0 &&
+           std::memcmp(arena.data(stored.offset()), key.data(),
+                       key.size()) == 0;
+  }
+
+  /// \brief The bytes of a stored key. Only valid until the next insertion.
+  std::string_view view(const stored_type &stored) const noexcept {
+    return {stored.isInline() ? stored.inlineData
+                              : arena.data(stored.offset()),
+            stored.length};
+  }
+
+  size_t memoryUsage() const noexcept { return arena.capacity(); }
+};
+} // namespace caching
@@ -1,12 +1,17 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <functional>
 #include <list>
 #include <optional>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "caching/memory_stats.hpp"
 #include "caching/pool_allocator.hpp"
+#include "caching/serialization.hpp"
 
 namespace caching {
 
@@ -18,33 +23,207 @@ namespace caching {
 /// \tparam TValue The type of cached values
 /// \tparam AllocBlockSize The number of elements to allocate at once to reduce
 /// the number of total allocations
-template <typename TKey, typename TValue, unsigned AllocBlockSize = 1024>
+/// \tparam THash The hash function for the keys. std::unordered_map uses a
+/// prime number of buckets, so the identity hash of std::hash for integers is
+/// fine here. Use caching::hash for a faster hash of long strings
+/// \tparam TKeyEqual The key comparison function. If both, THash and
+/// TKeyEqual, are transparent, get() and peek() accept keys of other types
+/// without converting them to TKey (requires C++20)
+template <typename TKey, typename TValue, unsigned AllocBlockSize = 1024,
+          typename THash = std::hash<TKey>,
+          typename TKeyEqual = std::equal_to<TKey>>
 class lru_cache {
-  // The cache actually does not deallocate any memory before destructing it, so
-  // the allocators do not need a freelist
+  // Entries removed by erase(), clear(), eraseIf() or evictSome() return their
+  // nodes to the allocators' freelists, such that later insertions can reuse
+  // them instead of allocating new blocks
 
+  // first points to the key in the map node. It is nullptr, if the entry has
+  // been erased or replaced while it was pinned (it is detached)
   using ListElemTy = std::pair<const TKey *, TValue>;
-  using ListAllocTy = pool_allocator<ListElemTy, false, AllocBlockSize>;
+  using ListAllocTy = pool_allocator<ListElemTy, true, AllocBlockSize>;
   using ListTy = std::list<ListElemTy, ListAllocTy>;
 
   using MapPairTy = std::pair<const TKey, typename ListTy::iterator>;
-  using MapAllocTy = pool_allocator<MapPairTy, false, AllocBlockSize>;
+  using MapAllocTy = pool_allocator<MapPairTy, true, AllocBlockSize>;
   using MapTy =
-      std::unordered_map<TKey, typename ListTy::iterator, std::hash<TKey>,
-                         std::equal_to<TKey>, MapAllocTy>;
+      std::unordered_map<TKey, typename ListTy::iterator, THash, TKeyEqual,
+                         MapAllocTy>;
 
   MapTy dict;
   mutable ListTy cache;
 
   size_t limit;
+  /// The number of nodes in the first block of the pool allocators
+  unsigned firstBlockSize;
+  /// The maximum numbers of list and map nodes allocated at a time. The
+  /// pools never shrink, so they determine the reserved memory
+  size_t peakListNodes = 0;
+  size_t peakMapNodes = 0;
+  /// The number of pin_handles of each pinned entry, including the detached
+  /// ones. Kept out of the list nodes, such that caches without pins do not
+  /// pay for a counter per entry
+  std::unordered_map<const ListElemTy *, unsigned> pinCounts;
+  /// The number of detached entries, which stay in the list until they are
+  /// unpinned
+  size_t numDetached = 0;
+  /// The entries prepared by findOrPrepare(), that are not filled yet. The
+  /// ticket tells apart different entries that reuse the same map node
+  struct PreparedSlot {
+    const MapPairTy *slot;
+    uint64_t ticket;
+  };
+  std::vector<PreparedSlot> preparedSlots;
+  uint64_t nextTicket = 0;
+
+  std::function<void(const TKey &, TValue &&)> onEvict;
+
+  void trackPeak() noexcept {
+    peakListNodes = std::max(peakListNodes, cache.size());
+    peakMapNodes = std::max(peakMapNodes, dict.size());
+  }
+
+  bool isPinned(typename ListTy::const_iterator it) const noexcept {
+    return !pinCounts.empty() && pinCounts.count(&*it);
+  }
+
+  /// The least recently used entry at or after it, that is not pinned, or
+  /// cache.end() if there is none. Pinned entries keep their position in the
+  /// LRU order.
+  typename ListTy::iterator
+  firstEvictable(typename ListTy::iterator it) noexcept {
+    while (it != cache.end() && isPinned(it))
+      ++it;
+    return it;
+  }
+
+  /// Detaches the pinned entry it from its key. The caller removes the key
+  /// from the map.
+  void detach(typename ListTy::iterator it) noexcept {
+    assert(isPinned(it) && "Only pinned entries are detached");
+    it->first = nullptr;
+    ++numDetached;
+  }
+
+  void pinEntry(typename ListTy::iterator it) { ++pinCounts[&*it]; }
+
+  void unpinEntry(typename ListTy::iterator it) noexcept {
+    auto pinIt = pinCounts.find(&*it);
+    assert(pinIt != pinCounts.end() && "The entry is not pinned");
+    if (--pinIt->second)
+      return;
+
+    pinCounts.erase(pinIt);
+    if (!it->first) {
+      cache.erase(it);
+      --numDetached;
+    }
+  }
+
+  /// Replaces the value of the entry of slot and makes it the most recently
+  /// used one. Pinned values are not modified; Instead, the key gets a new
+  /// entry.
+  template <typename V> TValue &assign(MapPairTy &slot, V &&value) {
+    auto lstIt = slot.second;
+    if (isPinned(lstIt)) {
+      detach(lstIt);
+      slot.second =
+          cache.insert(cache.end(), {&slot.first, std::forward<V>(value)});
+      trackPeak();
+    } else {
+      cache.splice(cache.end(), cache, lstIt);
+      lstIt->second = std::forward<V>(value);
+    }
+    return slot.second->second;
+  }
+
+  /// Evicts the entry it, which must not be pinned.
+  /// \return The entry after it
+  typename ListTy::iterator evict(typename ListTy::iterator it) {
+    assert(it != cache.end() && !isPinned(it));
+    if (onEvict)
+      onEvict(*it->first, std::move(it->second));
+
+    dict.erase(*it->first);
+    return cache.erase(it);
+  }
+
+  /// Pays off a bounded part of the pending evictions after setLimit(), but
+  /// never evicts the most recently used entry
+  void evictExcessBeforeBack() {
+    if (size() <= limit)
+      return;
+
+    auto back = std::prev(cache.end());
+    auto victim = firstEvictable(cache.begin());
+    for (size_t evicted = 0; evicted < IncrementalEvictionBudget &&
+                             size() > limit && victim != cache.end() &&
+                             victim != back;
+         ++evicted)
+      victim = firstEvictable(evict(victim));
+  }
+
+  /// Removes slot from the prepared entries. If ticket is given, slot is only
+  /// removed, if it has been prepared with that ticket.
+  /// \return False, iff slot is not a prepared entry (any more)
+  bool forgetPrepared(const MapPairTy &slot,
+                      std::optional<uint64_t> ticket = std::nullopt) noexcept {
+    auto it = std::find_if(preparedSlots.rbegin(), preparedSlots.rend(),
+                           [&](const PreparedSlot &prepared) {
+                             return prepared.slot == &slot &&
+                                    (!ticket || prepared.ticket == *ticket);
+                           });
+    if (it == preparedSlots.rend())
+      return false;
+
+    *it = preparedSlots.back();
+    preparedSlots.pop_back();
+    return true;
+  }
+
+  /// Completes the entry of slot, that findOrPrepare() has prepared, with
+  /// value. Recycles the least recently used entry, if the cache is full.
+  template <typename V> TValue &fillPrepared(MapPairTy &slot, V &&value) {
+    assert(slot.second == cache.end() && "The entry is not prepared");
+    if (size() > limit)
+      evictSome(IncrementalEvictionBudget);
+
+    auto victim = size() < limit ? cache.end() : firstEvictable(cache.begin());
+    if (victim == cache.end()) {
+      slot.second =
+          cache.insert(cache.end(), {&slot.first, std::forward<V>(value)});
+      trackPeak();
+      forgetPrepared(slot);
+      return slot.second->second;
+    }
+
+    if (onEvict)
+      onEvict(*victim->first, std::move(victim->second));
+
+    dict.erase(*victim->first);
+    victim->first = &slot.first;
+    victim->second = std::forward<V>(value);
+    slot.second = victim;
+    forgetPrepared(slot);
+    cache.splice(cache.end(), cache, victim);
+    return victim->second;
+  }
 
 public:
+  /// \brief The maximum number of entries that each insert() evicts in
+  /// addition to the recycled LRU entry, while the cache is above its limit
+  /// after shrinking it with setLimit()
+  static constexpr size_t IncrementalEvictionBudget = 8;
+
+  /// \brief Identifies snapshots written by save()
+  static constexpr char SnapshotMagic[8] = {'L', 'R', 'U', 'C', 'A', 'C', 'H', 1};
+
   /// \brief Initializes a new, empty lru_cache
   /// \param limit The maximum number of elements that can be cached at a time
   explicit lru_cache(size_t limit) noexcept
-      : limit(limit),
-        dict(MapAllocTy((unsigned)std::min<size_t>(limit, AllocBlockSize))),
-        cache(ListAllocTy((unsigned)std::min<size_t>(limit, AllocBlockSize))) {
+      : dict(MapAllocTy((unsigned)std::min<size_t>(limit, AllocBlockSize))),
+        cache(ListAllocTy((unsigned)std::min<size_t>(limit, AllocBlockSize))),
+        limit(limit),
+        firstBlockSize((unsigned)std::min<size_t>(limit, AllocBlockSize)) {
     assert(limit && "The cache-limit may not be 0");
   }
 
@@ -54,7 +233,8 @@ public:
   /// \param initCap The number of elements for those memory should be
   /// preallocated
   explicit lru_cache(size_t limit, unsigned initCap)
-      : limit(limit), dict(MapAllocTy(initCap)), cache(ListAllocTy(initCap)) {
+      : dict(MapAllocTy(initCap)), cache(ListAllocTy(initCap)), limit(limit),
+        firstBlockSize(initCap) {
     assert(limit && "The cache-limit may not be 0");
     dict.reserve(initCap);
   }
@@ -62,6 +242,75 @@ public:
   /// \brief This is a move-only type
   lru_cache(const lru_cache &) = delete;
 
+  /// \brief The number of entries currently in the cache. This may be larger
+  /// than getLimit() after shrinking the limit with setLimit()
+  size_t size() const noexcept { return cache.size() - numDetached; }
+
+  /// \brief True, iff the cache contains no entries
+  bool empty() const noexcept { return size() == 0; }
+
+  /// \brief The maximum number of entries that can be cached at a time
+  size_t getLimit() const noexcept { return limit; }
+
+  /// \brief The number of entries that still have to be evicted to get the
+  /// cache back to its limit
+  size_t pendingEvictions() const noexcept {
+    return size() > limit ? size() - limit : 0;
+  }
+
+  /// \brief Changes the maximum number of entries that can be cached at a
+  /// time.
+  ///
+  /// Shrinking the limit does not evict any entry immediately. Instead, the
+  /// excess entries are evicted incrementally in LRU order: Each subsequent
+  /// insert(), getOrInsert() or entry_handle::fill() evicts up to
+  /// IncrementalEvictionBudget entries, whether the key is new or not. This
+  /// keeps the latency of a single operation bounded, even for large drops of
+  /// the limit. Lookups never evict, so workloads that rarely insert must
+  /// call evictSome() (e.g. until pendingEvictions() returns 0) to get back
+  /// to the new limit.
+  /// \param newLimit The new maximum number of entries. Must not be 0
+  void setLimit(size_t newLimit) noexcept {
+    assert(newLimit && "The cache-limit may not be 0");
+    limit = newLimit;
+  }
+
+  /// \brief Sets a callback that is invoked as handler(key, value) for each
+  /// entry right before it is evicted due to the limit. The handler may take
+  /// the value, but must not access the cache. Entries removed by erase(),
+  /// eraseIf() or clear() are not reported.
+  /// \param handler The callback, or nullptr to remove the current one
+  void setEvictionHandler(std::function<void(const TKey &, TValue &&)> handler) {
+    onEvict = std::move(handler);
+  }
+
+  /// \brief Evicts the least recently used entry, regardless of the limit.
+  /// Used by adaptors that bound the cache by something else than the number
+  /// of entries.
+  /// \return True, iff an entry was evicted
+  bool evictLeastRecentlyUsed() {
+    auto victim = firstEvictable(cache.begin());
+    if (victim == cache.end())
+      return false;
+
+    evict(victim);
+    return true;
+  }
+
+  /// \brief Evicts at most budget entries in LRU order, as long as the cache
+  /// holds more entries than its limit. Pinned entries are skipped.
+  /// \param budget The maximum number of entries to evict
+  /// \return The number of entries actually evicted
+  size_t evictSome(size_t budget) {
+    size_t evicted = 0;
+    auto victim = firstEvictable(cache.begin());
+    for (; evicted < budget && size() > limit && victim != cache.end();
+         ++evicted)
+      victim = firstEvictable(evict(victim));
+
+    return evicted;
+  }
+
   /// \brief Inserts the (key, value) pair into the cache, if there is no
   /// other entry with an equivalent key or if update is true.
   ///
@@ -80,52 +329,123 @@ public:
     // Is key already contained?
     auto it = dict.find(key);
     if (it != dict.end()) {
-      auto lstIt = it->second;
-      cache.splice(cache.end(), cache, lstIt);
+      // Complete an entry prepared by findOrPrepare()
+      if (it->second == cache.end())
+        return {&fillPrepared(*it, std::forward<V>(value)), true};
 
-      auto *retptr = &lstIt->second;
+      TValue *ret;
       if (update) {
-        *retptr = std::forward<V>(value);
+        ret = &assign(*it, std::forward<V>(value));
+      } else {
+        cache.splice(cache.end(), cache, it->second);
+        ret = &it->second->second;
       }
 
-      return {retptr, false};
+      // The entry of key is the most recently used one and is not evicted
+      evictExcessBeforeBack();
+      return {ret, false};
     }
 
     // Key is not contained.
-    // Can we just append?
+    // If the limit has been decreased by setLimit(), pay off a bounded part of
+    // the pending evictions. Do this before inserting, such that the new entry
+    // is not evicted if all other entries are pinned
+    if (size() > limit)
+      evictSome(IncrementalEvictionBudget);
+
+    // Can we just append? Also append if all entries are pinned
 
-    if (dict.size() != limit) {
+    auto victim = size() < limit ? cache.end() : firstEvictable(cache.begin());
+    if (victim == cache.end()) {
       auto pos = cache.insert(cache.end(), {nullptr, std::forward<V>(value)});
 
       auto [mapIt, unused] = dict.try_emplace(std::forward<K>(key), pos);
 
       pos->first = &mapIt->first;
+      trackPeak();
       return {&pos->second, true};
     }
     // We cannot just append, because we have reached the limit. So, delete
-    // the LRU item (cache.front()) but reuse the allocated nodes for
+    // the LRU item (usually cache.front()) but reuse the allocated nodes for
     // the new item to insert.
 
-    assert(!cache.empty());
+    if (onEvict)
+      onEvict(*victim->first, std::move(victim->second));
 
-    auto &front = cache.front();
-
-    auto nod = dict.extract(*cache.front().first);
+    auto nod = dict.extract(*victim->first);
 
     assert(!nod.empty());
 
     nod.key() = std::forward<K>(key);
-    nod.mapped() = cache.begin();
+    nod.mapped() = victim;
 
-    front.first = &nod.key();
-    front.second = std::forward<V>(value);
+    victim->first = &nod.key();
+    victim->second = std::forward<V>(value);
 
     auto ret = dict.insert(std::move(nod));
     assert(ret.inserted);
 
-    cache.splice(cache.end(), cache, cache.begin());
+    cache.splice(cache.end(), cache, victim);
+
+    return {&victim->second, true};
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// \param key The key of the entry to remove
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) {
+    auto it = dict.find(key);
+    if (it == dict.end() || it->second == cache.end())
+      return false;
+
+    // Pinned entries stay alive until they are unpinned
+    if (isPinned(it->second))
+      detach(it->second);
+    else
+      cache.erase(it->second);
+    dict.erase(it);
+    return true;
+  }
 
-    return {&front.second, true};
+  /// \brief Removes all entries from the cache. The limit stays unchanged
+  /// and the memory of the removed entries is kept for reuse.
+  void clear() noexcept {
+    if (!pinCounts.empty()) {
+      for (auto it = cache.begin(), end = cache.end(); it != end;) {
+        if (!isPinned(it)) {
+          it = cache.erase(it);
+          continue;
+        }
+        if (it->first)
+          detach(it);
+        ++it;
+      }
+    } else {
+      cache.clear();
+    }
+    dict.clear();
+    preparedSlots.clear();
+  }
+
+  /// \brief Removes all entries for that pred(key, value) returns true.
+  /// \param pred The predicate to invoke for each cached key-value pair in
+  /// LRU order
+  /// \return The number of removed entries
+  template <typename Pred> size_t eraseIf(Pred &&pred) {
+    size_t numErased = 0;
+    for (auto it = cache.begin(), end = cache.end(); it != end;) {
+      if (it->first && pred(*it->first, it->second)) {
+        dict.erase(*it->first);
+        ++numErased;
+        if (!isPinned(it)) {
+          it = cache.erase(it);
+          continue;
+        }
+        detach(it);
+      }
+      ++it;
+    }
+    return numErased;
   }
 
   /// \brief Inserts the (key, value) pair into the cache, if there is no
@@ -139,6 +459,183 @@ public:
     return *ret;
   }
 
+  ///
+  /// \brief The result of findOrPrepare(): Refers to either the cached value
+  /// of a key, or an entry prepared for the key, that fill() completes.
+  ///
+  /// A prepared entry is invisible to lookups and is never evicted. If the
+  /// handle is destroyed without filling it, e.g. because computing the value
+  /// threw an exception, the prepared entry is removed again. While the
+  /// handle is pending, the cache may be used for other keys, e.g. by
+  /// recursive computations.
+  ///
+  /// Any handle is invalidated as soon as its entry is evicted, erased or
+  /// removed by clear() or load(). Filled entries can be evicted by any later
+  /// insertion. An invalidated handle may only be destroyed.
+  class entry_handle {
+    friend class lru_cache;
+
+    lru_cache *owner;
+    MapPairTy *slot;
+    /// True, iff this handle prepared the entry and removes it if abandoned
+    bool owning;
+    /// Identifies the prepared entry, if owning
+    uint64_t ticket;
+
+    entry_handle(lru_cache *owner, MapPairTy *slot, bool owning,
+                 uint64_t ticket) noexcept
+        : owner(owner), slot(slot), owning(owning), ticket(ticket) {}
+
+  public:
+    entry_handle(entry_handle &&other) noexcept
+        : owner(other.owner), slot(other.slot), owning(other.owning),
+          ticket(other.ticket) {
+      other.owning = false;
+    }
+    entry_handle &operator=(entry_handle &&) = delete;
+
+    ~entry_handle() {
+      // The entry may have been filled by insert() and removed meanwhile, so
+      // check whether it is still prepared before accessing it
+      if (owning && owner->forgetPrepared(*slot, ticket))
+        owner->dict.erase(owner->dict.find(slot->first));
+    }
+
+    /// \brief True, iff the key has a cached value, i.e. it was found or the
+    /// handle has been filled
+    explicit operator bool() const noexcept {
+      return slot->second != owner->cache.end();
+    }
+
+    /// \brief The cached value. Requires that the key has a cached value
+    TValue &operator*() const noexcept { return slot->second->second; }
+    TValue *operator->() const noexcept { return &slot->second->second; }
+
+    /// \brief The key of the entry
+    const TKey &key() const noexcept { return slot->first; }
+
+    /// \brief Caches value for the key. Replaces the value, if it has been
+    /// inserted meanwhile.
+    /// \return A mutable reference to the cached value
+    template <typename V> TValue &fill(V &&value) {
+      // The entry is live afterwards; Its removal is up to the cache
+      if (slot->second == owner->cache.end()) {
+        auto &ret = owner->fillPrepared(*slot, std::forward<V>(value));
+        owning = false;
+        return ret;
+      }
+
+      owning = false;
+      auto &ret = owner->assign(*slot, std::forward<V>(value));
+      owner->evictExcessBeforeBack();
+      return ret;
+    }
+  };
+
+  /// \brief Looks up key and prepares an entry for it, if it is not cached,
+  /// with a single hash and probe of the index. Updates the LRU order on
+  /// hits.
+  ///
+  /// Use this instead of get() followed by insert() on a miss, which hashes
+  /// and probes the key up to three times:
+  /// \code
+  /// auto entry = cache.findOrPrepare(key);
+  /// if (!entry)
+  ///   entry.fill(compute(key));
+  /// use(*entry);
+  /// \endcode
+  /// \param key The key to search for. Only moved from, if it is not cached
+  /// \return A handle to the cached or prepared entry
+  template <typename K> entry_handle findOrPrepare(K &&key) {
+    auto [it, inserted] = dict.try_emplace(std::forward<K>(key), cache.end());
+    if (inserted) {
+      trackPeak();
+      preparedSlots.push_back({&*it, ++nextTicket});
+    } else if (it->second != cache.end())
+      cache.splice(cache.end(), cache, it->second);
+    return entry_handle(this, &*it, inserted, nextTicket);
+  }
+
+  ///
+  /// \brief A counted reference to a cached value, that keeps the value alive
+  /// and in place across later operations on the cache.
+  ///
+  /// While an entry is pinned, evictions skip it without changing its position
+  /// in the LRU order, so the cache may exceed its limit if all entries are
+  /// pinned. Each eviction walks past the pinned entries at the front of the
+  /// LRU order, so pin only few entries at a time.
+  ///
+  /// If a pinned entry is erased or its value is replaced, the key is
+  /// detached from the pinned value immediately, but the value itself is
+  /// destroyed only when its last handle is released. Handles must not
+  /// outlive their cache.
+  class pin_handle {
+    friend class lru_cache;
+
+    lru_cache *owner = nullptr;
+    typename ListTy::iterator entry;
+
+    pin_handle(lru_cache *owner, typename ListTy::iterator entry)
+        : owner(owner), entry(entry) {
+      owner->pinEntry(entry);
+    }
+
+  public:
+    /// \brief Creates an empty handle
+    pin_handle() noexcept = default;
+
+    pin_handle(const pin_handle &other)
+        : owner(other.owner), entry(other.entry) {
+      if (owner)
+        owner->pinEntry(entry);
+    }
+    pin_handle(pin_handle &&other) noexcept
+        : owner(std::exchange(other.owner, nullptr)), entry(other.entry) {}
+    pin_handle &operator=(pin_handle other) noexcept {
+      std::swap(owner, other.owner);
+      std::swap(entry, other.entry);
+      return *this;
+    }
+    ~pin_handle() { reset(); }
+
+    /// \brief Releases the pin, if any, and empties this handle
+    void reset() noexcept {
+      if (owner) {
+        owner->unpinEntry(entry);
+        owner = nullptr;
+      }
+    }
+
+    /// \brief True, iff this handle refers to a value
+    explicit operator bool() const noexcept { return owner != nullptr; }
+
+    /// \brief The pinned value. Requires a non-empty handle
+    const TValue &operator*() const noexcept { return entry->second; }
+    const TValue *operator->() const noexcept { return &entry->second; }
+
+    /// \brief True, iff the pinned value has been erased or replaced in the
+    /// cache since it was pinned
+    bool isDetached() const noexcept { return !entry->first; }
+  };
+
+  /// \brief Looks up the value associated to key in the cache and pins it.
+  /// Updates the LRU order.
+  /// \param key The key to search for
+  /// \return A handle to the pinned value, or an empty handle, iff key is
+  /// not present in the cache
+  pin_handle pin(const TKey &key) {
+    auto it = dict.find(key);
+    if (it == dict.end() || it->second == cache.end())
+      return {};
+
+    cache.splice(cache.end(), cache, it->second);
+    return pin_handle(this, it->second);
+  }
+
+  /// \brief The number of pinned entries, including the ones that have been
+  /// erased or replaced since they were pinned
+  size_t pinnedCount() const noexcept { return pinCounts.size(); }
+
   /// \brief Looks up the value associated to key in the cache. Updates the LRU
   /// order.
   /// \param key The key to search for
@@ -148,7 +645,7 @@ public:
   std::optional<std::reference_wrapper<const TValue>>
   get(const TKey &key) const noexcept {
     auto it = dict.find(key);
-    if (it != dict.end()) {
+    if (it != dict.end() && it->second != cache.end()) {
       cache.splice(cache.end(), cache, it->second);
       return std::cref(it->second->second);
     }
@@ -164,19 +661,36 @@ public:
   /// more).
   std::optional<std::reference_wrapper<TValue>> get(const TKey &key) noexcept {
     auto it = dict.find(key);
-    if (it != dict.end()) {
+    if (it != dict.end() && it->second != cache.end()) {
+      cache.splice(cache.end(), cache, it->second);
+      return std::ref(it->second->second);
+    }
+
+    return std::nullopt;
+  }
+
+#if defined(__cpp_lib_generic_unordered_lookup)
+  /// \brief Same as get(const TKey&), but for a key of another type, that is
+  /// not converted to TKey. Requires a transparent THash and TKeyEqual.
+  template <typename K, typename H = THash, typename E = TKeyEqual,
+            typename = typename H::is_transparent,
+            typename = typename E::is_transparent>
+  std::optional<std::reference_wrapper<TValue>> get(const K &key) noexcept {
+    auto it = dict.find(key);
+    if (it != dict.end() && it->second != cache.end()) {
       cache.splice(cache.end(), cache, it->second);
       return std::ref(it->second->second);
     }
 
     return std::nullopt;
   }
+#endif
 
   /// \brief Same as get(const TKey&)const, but without updating the LRU order.
   std::optional<std::reference_wrapper<const TValue>>
   peek(const TKey &key) const noexcept {
     auto it = dict.find(key);
-    if (it != dict.end())
+    if (it != dict.end() && it->second != cache.end())
       return std::cref(it->second->second);
 
     return std::nullopt;
@@ -185,12 +699,124 @@ public:
   /// \brief Same as get(const TKey&), but without updating the LRU order.
   std::optional<std::reference_wrapper<TValue>> peek(const TKey &key) noexcept {
     auto it = dict.find(key);
-    if (it != dict.end())
+    if (it != dict.end() && it->second != cache.end())
       return std::ref(it->second->second);
 
     return std::nullopt;
   }
 
+#if defined(__cpp_lib_generic_unordered_lookup)
+  /// \brief Same as get(const K&), but without updating the LRU order.
+  template <typename K, typename H = THash, typename E = TKeyEqual,
+            typename = typename H::is_transparent,
+            typename = typename E::is_transparent>
+  std::optional<std::reference_wrapper<const TValue>>
+  peek(const K &key) const noexcept {
+    auto it = dict.find(key);
+    if (it != dict.end() && it->second != cache.end())
+      return std::cref(it->second->second);
+
+    return std::nullopt;
+  }
+#endif
+
+  /// \brief Estimates the memory used by this cache, assuming a typical
+  /// node-based implementation of std::list and std::unordered_map: Each entry
+  /// needs a list node with two links and a map node with one link, a copy of
+  /// the key and the cached hash. The total includes all nodes that the pool
+  /// allocators reserved, i.e. also the nodes of removed entries, which are
+  /// kept for reuse. See compact_lru_cache for a layout with less overhead.
+  memory_stats memoryUsage() const noexcept {
+    constexpr size_t listNodeSize = 2 * sizeof(void *) + sizeof(ListElemTy);
+    constexpr size_t mapNodeSize =
+        sizeof(void *) + sizeof(MapPairTy) + sizeof(size_t);
+
+    memory_stats ret;
+    ret.entries = size();
+    ret.payloadBytes = size() * (sizeof(TKey) + sizeof(TValue));
+    ret.totalBytes =
+        sizeof(*this) + dict.bucket_count() * sizeof(void *) +
+        ListAllocTy::reservedFor(peakListNodes, firstBlockSize) *
+            listNodeSize +
+        MapAllocTy::reservedFor(peakMapNodes, firstBlockSize) * mapNodeSize;
+    return ret;
+  }
+
+  /// \brief Writes all entries in LRU order (least recently used first) to os.
+  ///
+  /// The snapshot starts with a small header followed by the number of
+  /// entries and the serialized key-value pairs. Variable-length data is
+  /// length-prefixed by the serializers. Does not update the LRU order.
+  /// \tparam KeySerializer The serializer used for writing keys
+  /// \tparam ValueSerializer The serializer used for writing values
+  /// \param os The binary stream to write to
+  /// \return True, iff writing was successful
+  template <typename KeySerializer = serializer<TKey>,
+            typename ValueSerializer = serializer<TValue>>
+  bool save(std::ostream &os) const {
+    os.write(SnapshotMagic, sizeof(SnapshotMagic));
+    detail::writeVarint(os, size());
+    forEach([&os](const TKey &key, const TValue &value) {
+      KeySerializer::write(os, key);
+      ValueSerializer::write(os, value);
+    });
+    return bool(os);
+  }
+
+  /// \brief Replaces the contents of this cache by a snapshot previously
+  /// written by save().
+  ///
+  /// The LRU order of the snapshot is restored. If the snapshot contains more
+  /// entries than the limit, only the most recently used ones are loaded. The
+  /// index is sized for all loaded entries in advance, so it does not need to
+  /// rehash while loading.
+  /// \tparam KeySerializer The serializer used for reading keys
+  /// \tparam ValueSerializer The serializer used for reading values
+  /// \param is The binary stream to read from
+  /// \return True, iff the snapshot was read completely. Otherwise, the cache
+  /// contains the entries read before the error.
+  template <typename KeySerializer = serializer<TKey>,
+            typename ValueSerializer = serializer<TValue>>
+  bool load(std::istream &is) {
+    clear();
+
+    char magic[sizeof(SnapshotMagic)];
+    if (!is.read(magic, sizeof(magic)) ||
+        !std::equal(std::begin(magic), std::end(magic), SnapshotMagic))
+      return false;
+
+    uint64_t count;
+    if (!detail::readVarint(is, count))
+      return false;
+
+    auto numSkip = count > limit ? count - limit : 0;
+    dict.reserve(count - numSkip);
+
+    TKey key{};
+    TValue value{};
+    for (uint64_t i = 0; i < count; ++i) {
+      if (!KeySerializer::read(is, key) || !ValueSerializer::read(is, value))
+        return false;
+
+      if (i < numSkip)
+        continue;
+
+      auto pos = cache.insert(cache.end(), {nullptr, std::move(value)});
+      auto [mapIt, inserted] = dict.try_emplace(std::move(key), pos);
+      trackPeak();
+      if (inserted) {
+        pos->first = &mapIt->first;
+      } else {
+        // Duplicate key: The later entry is the more recent one
+        mapIt->second->second = std::move(pos->second);
+        cache.splice(cache.end(), cache, mapIt->second);
+        cache.erase(pos);
+      }
+    }
+
+    return true;
+  }
+
   /// \brief Iterates all entries in the cache in LRU order (least recently used
   /// first) and calls fn(key, value) for each entry. Does not update the
   /// LRU order.
@@ -200,7 +826,8 @@ public:
   void forEach(Fn &&fn) const
       noexcept(noexcept(fn(std::declval<TKey>(), std::declval<TValue>()))) {
     for (auto &it : cache) {
-      fn(*it.first, it.second);
+      if (it.first)
+        fn(*it.first, it.second);
     }
   }
 
@@ -213,7 +840,8 @@ public:
   void forEach(Fn &&fn) noexcept(noexcept(fn(std::declval<TKey>(),
                                              std::declval<TValue>()))) {
     for (auto &it : cache) {
-      fn(*it.first, it.second);
+      if (it.first)
+        fn(*it.first, it.second);
     }
   }
 };
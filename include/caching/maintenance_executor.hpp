@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace caching {
+
+///
+/// \brief A small pool of background threads for the maintenance of
+/// concurrent caches, such as evicting entries and draining buffers.
+///
+/// Every worker has its own task queue. Tasks that a worker submits (e.g. a
+/// batch that reschedules its remainder) go to the worker's own queue, other
+/// tasks are distributed round-robin. A worker without tasks steals the
+/// oldest task of another worker, so a shard with a burst of maintenance work
+/// does not keep a single worker busy while the others idle.
+///
+/// Tasks must be short, bounded batches and must not block on each other.
+/// The executor must outlive all caches that use it; Its destructor runs all
+/// remaining tasks before it joins the workers.
+class maintenance_executor {
+  struct alignas(64) Worker {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+
+  std::mutex sleepMutex;
+  std::condition_variable wakeup;
+  std::atomic<size_t> numQueued{0};
+  std::atomic<size_t> nextWorker{0};
+  bool stopping = false;
+
+  /// The executor and the index of the worker of the current thread, if it
+  /// is a worker
+  static inline thread_local const maintenance_executor *currentExecutor =
+      nullptr;
+  static inline thread_local size_t currentWorker = 0;
+
+  bool pop(size_t self, std::function<void()> &task) {
+    // Own tasks in LIFO order, since they are likely still in the cache
+    {
+      auto &w = *workers[self];
+      std::lock_guard lck(w.mutex);
+      if (!w.tasks.empty()) {
+        task = std::move(w.tasks.back());
+        w.tasks.pop_back();
+        return true;
+      }
+    }
+
+    // Steal the oldest task of another worker
+    for (size_t i = 1; i < workers.size(); ++i) {
+      auto &w = *workers[(self + i) % workers.size()];
+      std::lock_guard lck(w.mutex);
+      if (!w.tasks.empty()) {
+        task = std::move(w.tasks.front());
+        w.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(size_t self) {
+    currentExecutor = this;
+    currentWorker = self;
+
+    std::function<void()> task;
+    for (;;) {
+      if (pop(self, task)) {
+        numQueued.fetch_sub(1, std::memory_order_relaxed);
+        task();
+        task = nullptr;
+        continue;
+      }
+
+      std::unique_lock lck(sleepMutex);
+      wakeup.wait(lck, [this] {
+        return stopping || numQueued.load(std::memory_order_relaxed) != 0;
+      });
+      if (stopping && numQueued.load(std::memory_order_relaxed) == 0)
+        return;
+    }
+  }
+
+public:
+  /// \brief Starts numThreads workers
+  explicit maintenance_executor(unsigned numThreads = 1) {
+    if (!numThreads)
+      numThreads = 1;
+
+    for (unsigned i = 0; i < numThreads; ++i)
+      workers.push_back(std::make_unique<Worker>());
+    for (unsigned i = 0; i < numThreads; ++i)
+      threads.emplace_back([this, i] { run(i); });
+  }
+
+  /// \brief Runs all remaining tasks and joins the workers
+  ~maintenance_executor() {
+    {
+      std::lock_guard lck(sleepMutex);
+      stopping = true;
+    }
+    wakeup.notify_all();
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  /// \brief This type is neither copyable nor movable
+  maintenance_executor(const maintenance_executor &) = delete;
+  maintenance_executor &operator=(const maintenance_executor &) = delete;
+
+  /// \brief The number of worker threads
+  size_t threadCount() const noexcept { return threads.size(); }
+
+  /// \brief The number of tasks that wait for a worker
+  size_t pending() const noexcept {
+    return numQueued.load(std::memory_order_relaxed);
+  }
+
+  /// \brief Schedules task to run on one of the workers
+  void submit(std::function<void()> task) {
+    auto idx = currentExecutor == this
+                   ? currentWorker
+                   : nextWorker.fetch_add(1, std::memory_order_relaxed) %
+                         workers.size();
+    {
+      auto &w = *workers[idx];
+      std::lock_guard lck(w.mutex);
+      w.tasks.push_back(std::move(task));
+      numQueued.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Synchronize with workers, that are about to sleep
+    { std::lock_guard lck(sleepMutex); }
+    wakeup.notify_one();
+  }
+};
+} // namespace caching
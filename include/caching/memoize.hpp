@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "caching/hash.hpp"
+#include "caching/lru_cache.hpp"
+
+namespace caching {
+
+namespace detail {
+/// \brief Deduces the signature R(Args...) of a callable with a single,
+/// non-generic call operator or of a function (pointer)
+template <typename Fn>
+struct call_signature : call_signature<decltype(&Fn::operator())> {};
+
+template <typename R, typename... Args> struct call_signature<R(Args...)> {
+  using type = R(Args...);
+};
+template <typename R, typename... Args>
+struct call_signature<R(Args...) noexcept> : call_signature<R(Args...)> {};
+template <typename R, typename... Args>
+struct call_signature<R (*)(Args...)> : call_signature<R(Args...)> {};
+template <typename R, typename... Args>
+struct call_signature<R (*)(Args...) noexcept> : call_signature<R(Args...)> {};
+
+template <typename C, typename R, typename... Args>
+struct call_signature<R (C::*)(Args...)> : call_signature<R(Args...)> {};
+template <typename C, typename R, typename... Args>
+struct call_signature<R (C::*)(Args...) const> : call_signature<R(Args...)> {};
+template <typename C, typename R, typename... Args>
+struct call_signature<R (C::*)(Args...) noexcept>
+    : call_signature<R(Args...)> {};
+template <typename C, typename R, typename... Args>
+struct call_signature<R (C::*)(Args...) const noexcept>
+    : call_signature<R(Args...)> {};
+} // namespace detail
+
+template <typename Fn, typename Signature> class memoized;
+
+///
+/// \brief A callable that caches the results of the pure function Fn for the
+/// most recently used arguments. This type is not thread-safe.
+///
+/// The arguments are decayed and stored as a std::tuple key of an lru_cache,
+/// which hashes them with caching::hash<std::tuple>. Hits and misses hash
+/// the arguments and probe the cache once (see lru_cache::findOrPrepare).
+/// With C++20, arguments that are not trivially copyable are looked up as a
+/// tuple of references first, so hits do not copy them.
+///
+/// If Fn is invocable with a reference to the memoized callable followed by
+/// the arguments, it is called that way, such that recursive calls go through
+/// the cache as well:
+/// \code
+/// auto fib = memoize<100, uint64_t(uint64_t)>(
+///     [](auto &self, uint64_t n) -> uint64_t {
+///       return n < 2 ? n : self(n - 1) + self(n - 2);
+///     });
+/// \endcode
+///
+/// \tparam Fn The type of the wrapped callable
+/// \tparam R The result type; Results are returned by value
+/// \tparam Args The parameter types of the memoized function
+template <typename Fn, typename R, typename... Args>
+class memoized<Fn, R(Args...)> {
+public:
+  using key_type = std::tuple<std::decay_t<Args>...>;
+  using cache_type =
+      lru_cache<key_type, R, 1024, hash<key_type>, std::equal_to<>>;
+
+private:
+  Fn fn;
+  cache_type results;
+
+  R compute(const std::decay_t<Args> &...args) {
+    if constexpr (std::is_invocable_r_v<R, Fn &, memoized &,
+                                        const std::decay_t<Args> &...>)
+      return std::invoke(fn, *this, args...);
+    else
+      return std::invoke(fn, args...);
+  }
+
+public:
+  /// \brief Wraps fn, such that the results of the capacity most recently
+  /// used arguments are cached
+  memoized(Fn fn, size_t capacity) : fn(std::move(fn)), results(capacity) {}
+
+  /// \brief Returns the cached result for args, or calls the wrapped function
+  /// and caches its result
+  R operator()(const std::decay_t<Args> &...args) {
+#if defined(__cpp_lib_generic_unordered_lookup)
+    // Avoid copying expensive arguments on hits, at the cost of a second
+    // probe on misses
+    if constexpr (!(std::is_trivially_copyable_v<std::decay_t<Args>> && ...)) {
+      if (auto hit = results.get(std::forward_as_tuple(args...)))
+        return hit->get();
+    }
+#endif
+
+    auto entry = results.findOrPrepare(key_type(args...));
+    if (entry)
+      return *entry;
+
+    // Recursive calls may use the cache meanwhile; The prepared entry is
+    // neither visible nor evicted until it is filled
+    return entry.fill(compute(args...));
+  }
+
+  /// \brief The cache of results
+  cache_type &cache() noexcept { return results; }
+  const cache_type &cache() const noexcept { return results; }
+};
+
+/// \brief Memoizes the results of fn for the Capacity most recently used
+/// arguments. The signature is deduced from fn, which must not be generic.
+template <size_t Capacity, typename Fn,
+          typename Signature =
+              typename detail::call_signature<std::decay_t<Fn>>::type>
+memoized<std::decay_t<Fn>, Signature> memoize(Fn &&fn) {
+  static_assert(Capacity > 0, "The capacity may not be 0");
+  return {std::forward<Fn>(fn), Capacity};
+}
+
+/// \brief Memoizes the results of fn for the Capacity most recently used
+/// arguments with the explicitly given signature. Use this overload for
+/// recursive functions, whose first parameter is the memoized callable.
+template <size_t Capacity, typename Signature, typename Fn,
+          typename = std::enable_if_t<std::is_function_v<Signature>>>
+memoized<std::decay_t<Fn>, Signature> memoize(Fn &&fn) {
+  static_assert(Capacity > 0, "The capacity may not be 0");
+  return {std::forward<Fn>(fn), Capacity};
+}
+} // namespace caching
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+namespace caching {
+
+/// \brief The memory consumption of a cache as reported by its memoryUsage()
+struct memory_stats {
+  /// The number of cached entries
+  size_t entries = 0;
+  /// The number of bytes of all keys and values, i.e. entries * (sizeof(TKey)
+  /// + sizeof(TValue)). Memory owned by the keys and values themselves (e.g.
+  /// the heap buffer of an std::string) is not included.
+  size_t payloadBytes = 0;
+  /// The number of bytes used by the cache, including payloadBytes and
+  /// memory that is reserved for future entries
+  size_t totalBytes = 0;
+
+  /// \brief The average number of bytes per entry that are not payload
+  double overheadPerEntry() const noexcept {
+    return entries ? double(totalBytes - payloadBytes) / double(entries) : 0;
+  }
+};
+} // namespace caching
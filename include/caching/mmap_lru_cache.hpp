@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "caching/offset_lru_cache.hpp"
+
+namespace caching {
+
+namespace detail {
+/// \brief Owns a shared, writable mapping of a whole file
+class file_mapping {
+  int fd = -1;
+  void *addr = nullptr;
+  size_t len = 0;
+  bool sizeMatched = false;
+
+  [[noreturn]] static void fail(const char *what) {
+    throw std::system_error(errno, std::generic_category(), what);
+  }
+
+public:
+  /// \brief Maps the file at path with exactly len bytes. The file is created
+  /// or resized if necessary.
+  /// \throws std::system_error if the file cannot be opened or mapped
+  file_mapping(const std::string &path, size_t len) : len(len) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+      fail("open");
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      fail("fstat");
+    }
+
+    sizeMatched = size_t(st.st_size) == len;
+    if (!sizeMatched && ::ftruncate(fd, off_t(len)) != 0) {
+      ::close(fd);
+      fail("ftruncate");
+    }
+
+    addr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      fail("mmap");
+    }
+  }
+
+  file_mapping(const file_mapping &) = delete;
+  file_mapping &operator=(const file_mapping &) = delete;
+
+  ~file_mapping() {
+    ::munmap(addr, len);
+    ::close(fd);
+  }
+
+  void *data() const noexcept { return addr; }
+  size_t length() const noexcept { return len; }
+
+  /// \brief True, iff the file already had the requested size before mapping
+  bool hadMatchingSize() const noexcept { return sizeMatched; }
+
+  /// \brief Writes the dirty pages back to the file
+  bool sync(bool async = false) noexcept {
+    return ::msync(addr, len, async ? MS_ASYNC : MS_SYNC) == 0;
+  }
+};
+} // namespace detail
+
+///
+/// \brief A persistent LRU cache with a fixed limit for trivially copyable
+/// keys and values. This cache is not thread-safe.
+///
+/// The whole cache (index, nodes and LRU links) lives in a file-backed shared
+/// memory mapping, see offset_lru_cache. When the cache is reopened with the
+/// same limit and key/value layout, the previous contents are usable
+/// immediately without deserialization; the OS page cache loads the pages
+/// lazily on first access.
+///
+/// The file is marked clean when the cache is destroyed. A file that was not
+/// closed properly (e.g. because the process crashed) may be inconsistent, so
+/// it is formatted as an empty cache instead of being restored.
+///
+/// \tparam TKey The key type. Must be trivially copyable
+/// \tparam TValue The type of cached values. Must be trivially copyable
+/// \tparam THash The hash function. Must be the same for all processes that
+/// open the file
+/// \tparam TKeyEqual The key comparison function
+template <typename TKey, typename TValue, typename THash = hash<TKey>,
+          typename TKeyEqual = std::equal_to<TKey>>
+class mmap_lru_cache : private detail::file_mapping,
+                       public offset_lru_cache<TKey, TValue, THash, TKeyEqual> {
+  using BaseTy = offset_lru_cache<TKey, TValue, THash, TKeyEqual>;
+
+public:
+  using typename BaseTy::index_type;
+
+  /// \brief Opens or creates the cache file at path.
+  /// \param path The file to store the cache in
+  /// \param limit The maximum number of elements that can be cached at a time
+  /// \throws std::system_error if the file cannot be opened or mapped
+  mmap_lru_cache(const std::string &path, index_type limit)
+      : file_mapping(path, BaseTy::requiredSize(limit)),
+        BaseTy(file_mapping::data(), limit, file_mapping::hadMatchingSize()) {
+    BaseTy::markClean(false);
+  }
+
+  ~mmap_lru_cache() {
+    BaseTy::markClean(true);
+    file_mapping::sync();
+  }
+
+  /// \brief Writes all modifications back to the file. The file stays marked
+  /// as being modified until the cache is destroyed.
+  /// \param async True, iff the write-back should only be scheduled
+  /// \return True on success
+  bool flush(bool async = false) noexcept { return file_mapping::sync(async); }
+};
+} // namespace caching
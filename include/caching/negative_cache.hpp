@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "caching/hash.hpp"
+#include "caching/lru_cache.hpp"
+
+namespace caching {
+
+///
+/// \brief A compact, approximate set of the recently inserted keys, meant to
+/// remember keys that are known to be absent from a backend. This type is not
+/// thread-safe.
+///
+/// The filter consists of two generations of Bloom filters. Keys are inserted
+/// into the current generation, and lookups test both. Once the current
+/// generation holds capacity keys, the older generation is cleared and
+/// becomes the current one. Hence, the filter remembers at least the last
+/// capacity and at most the last 2 * capacity inserted keys, and each
+/// generation uses a fixed number of bits.
+///
+/// contains() may return true for keys that were never inserted (false
+/// positives), with a probability of at most falsePositiveRate. The same
+/// holds approximately for keys that have been invalidated since their last
+/// insertion, since later insertions of other keys may set their bits again.
+///
+/// \tparam TKey The type of the keys
+/// \tparam THash The hash function. Must mix the bits of the key well
+template <typename TKey, typename THash = hash<TKey>> class negative_filter {
+  struct Generation {
+    std::vector<uint64_t> words;
+    /// The number of keys inserted into this generation
+    size_t count = 0;
+  };
+
+  Generation generations[2];
+  unsigned current = 0;
+
+  size_t capacity;
+  uint64_t bitMask;
+  unsigned numProbes;
+  THash hasher;
+
+  /// The bit of the i-th probe (double hashing)
+  uint64_t bitOf(uint64_t hash, unsigned i) const noexcept {
+    return (hash + i * ((hash >> 32) | 1)) & bitMask;
+  }
+
+  bool test(const Generation &gen, uint64_t hash) const noexcept {
+    for (unsigned i = 0; i < numProbes; ++i) {
+      auto bit = bitOf(hash, i);
+      if (!(gen.words[bit / 64] & (uint64_t(1) << (bit % 64))))
+        return false;
+    }
+    return true;
+  }
+
+  void rotate() noexcept {
+    current ^= 1;
+    auto &gen = generations[current];
+    std::fill(gen.words.begin(), gen.words.end(), 0);
+    gen.count = 0;
+  }
+
+public:
+  /// \brief Initializes a new, empty negative_filter
+  /// \param capacity The number of keys per generation
+  /// \param falsePositiveRate The maximum probability, that contains()
+  /// returns true for a key that was not inserted
+  explicit negative_filter(size_t capacity, double falsePositiveRate = 0.01)
+      : capacity(capacity) {
+    assert(capacity && "The capacity may not be 0");
+    assert(falsePositiveRate > 0 && falsePositiveRate < 1 &&
+           "The false positive rate must be in (0, 1)");
+
+    // A lookup tests both generations, so each one may have half the rate.
+    // The optimal Bloom filter for n keys and rate p has -n ln p / ln(2)^2
+    // bits and -log2 p probes. Rounding the bits up to a power of two only
+    // lowers the rate.
+    auto rate = falsePositiveRate / 2;
+    auto minBits = std::ceil(-double(capacity) * std::log(rate) /
+                             (std::log(2.0) * std::log(2.0)));
+    uint64_t numBits = 64;
+    while (double(numBits) < minBits)
+      numBits <<= 1;
+
+    bitMask = numBits - 1;
+    numProbes = std::max(1u, unsigned(std::lround(-std::log2(rate))));
+    for (auto &gen : generations)
+      gen.words.resize(numBits / 64);
+  }
+
+  /// \brief The number of keys per generation
+  size_t getCapacity() const noexcept { return capacity; }
+
+  /// \brief The number of bytes used by both generations
+  size_t memoryUsage() const noexcept {
+    return 2 * generations[0].words.size() * sizeof(uint64_t);
+  }
+
+  /// \brief Inserts key into the current generation. Starts a new
+  /// generation and forgets the keys of the oldest one, if the current
+  /// generation is full.
+  void insert(const TKey &key) {
+    if (generations[current].count == capacity)
+      rotate();
+
+    auto hash = uint64_t(hasher(key));
+    auto &gen = generations[current];
+    bool added = false;
+    for (unsigned i = 0; i < numProbes; ++i) {
+      auto bit = bitOf(hash, i);
+      auto &word = gen.words[bit / 64];
+      auto flag = uint64_t(1) << (bit % 64);
+      added |= !(word & flag);
+      word |= flag;
+    }
+
+    // Keys that are (probably) contained already do not fill the generation
+    if (added)
+      ++gen.count;
+  }
+
+  /// \brief True, iff key has been inserted recently, or with a probability
+  /// of at most the false positive rate if it has not
+  bool contains(const TKey &key) const {
+    auto hash = uint64_t(hasher(key));
+    return test(generations[0], hash) || test(generations[1], hash);
+  }
+
+  /// \brief Removes key from the filter, such that contains(key) returns
+  /// true about as rarely as for keys that were never inserted, until key is
+  /// inserted again.
+  ///
+  /// Clears the bits of all probes of key in both generations, which may
+  /// drop a few other keys from the filter as well.
+  void invalidate(const TKey &key) {
+    auto hash = uint64_t(hasher(key));
+    for (auto &gen : generations) {
+      for (unsigned i = 0; i < numProbes; ++i) {
+        auto bit = bitOf(hash, i);
+        gen.words[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+      }
+    }
+  }
+
+  /// \brief Removes all keys from the filter
+  void clear() noexcept {
+    for (auto &gen : generations) {
+      std::fill(gen.words.begin(), gen.words.end(), 0);
+      gen.count = 0;
+    }
+  }
+};
+
+///
+/// \brief An lru_cache of the values of a backend, combined with a
+/// negative_filter of keys that were recently confirmed to be absent from the
+/// backend. This cache is not thread-safe.
+///
+/// Absent keys cost a few bits in the filter instead of an entry in the
+/// cache, so lookups of many different absent keys neither reach the backend
+/// again nor evict cached values. Since the filter has false positives,
+/// getOrLoad() may report an existing key as absent with a probability of
+/// about the filter's false positive rate. This includes keys that were
+/// marked absent and then inserted into this cache, once the cache evicts
+/// them.
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam TValue The type of cached values
+/// \tparam THash The hash function of the cache and the filter
+template <typename TKey, typename TValue, typename THash = hash<TKey>>
+class negative_cache {
+public:
+  using cache_type = lru_cache<TKey, TValue, 1024, THash>;
+  using filter_type = negative_filter<TKey, THash>;
+
+private:
+  cache_type values;
+  filter_type absent;
+  size_t numFiltered = 0;
+
+public:
+  /// \brief Initializes a new, empty negative_cache
+  /// \param limit The maximum number of cached values
+  /// \param absentCapacity The number of absent keys per generation of the
+  /// filter (see negative_filter)
+  /// \param falsePositiveRate The maximum probability, that an existing key
+  /// is reported as absent
+  negative_cache(size_t limit, size_t absentCapacity,
+                 double falsePositiveRate = 0.01)
+      : values(limit), absent(absentCapacity, falsePositiveRate) {}
+
+  /// \brief The number of cached values
+  size_t size() const noexcept { return values.size(); }
+
+  /// \brief The number of lookups, that the filter answered as absent
+  /// without calling the backend
+  size_t filtered() const noexcept { return numFiltered; }
+
+  /// \brief Looks up the value associated to key in the cache, or otherwise
+  /// calls load(key) unless key is known to be absent.
+  /// \param load The backend lookup. Returns an std::optional<TValue>, which
+  /// is empty iff key is absent from the backend
+  /// \return The value associated with key, or std::nullopt, iff key is
+  /// (known to be) absent
+  template <typename Loader>
+  std::optional<TValue> getOrLoad(const TKey &key, Loader &&load) {
+    if (auto hit = values.get(key))
+      return hit->get();
+
+    if (absent.contains(key)) {
+      ++numFiltered;
+      return std::nullopt;
+    }
+
+    std::optional<TValue> ret = std::invoke(std::forward<Loader>(load), key);
+    if (ret)
+      values.insert(key, *ret);
+    else
+      absent.insert(key);
+    return ret;
+  }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true. Removes key
+  /// from the absent keys. Call this when key is added to the backend.
+  /// \return True, iff key was not cached before
+  bool insert(const TKey &key, const TValue &value, bool update = false) {
+    absent.invalidate(key);
+    return values.insert(key, value, update).second;
+  }
+
+  /// \brief Records that key is absent from the backend and removes its
+  /// cached value, if any. Call this when key is removed from the backend.
+  void markAbsent(const TKey &key) {
+    values.erase(key);
+    absent.insert(key);
+  }
+
+  /// \brief Removes the cached value of key, if any, without recording key
+  /// as absent
+  /// \return True, iff a value was removed
+  bool erase(const TKey &key) { return values.erase(key); }
+
+  /// \brief Removes all cached values and absent keys
+  void clear() noexcept {
+    values.clear();
+    absent.clear();
+  }
+
+  /// \brief The cache of values
+  cache_type &cache() noexcept { return values; }
+  const cache_type &cache() const noexcept { return values; }
+
+  /// \brief The filter of absent keys
+  const filter_type &filter() const noexcept { return absent; }
+};
+} // namespace caching
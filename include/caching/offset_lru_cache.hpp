@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <type_traits>
+
+#include "caching/hash.hpp"
+
+namespace caching {
+
+///
+/// \brief An LRU cache with a fixed limit that lives entirely inside a
+/// caller-provided contiguous memory region. This cache is not thread-safe.
+///
+/// All links (the LRU list, the hash chains and the freelist) are stored as
+/// 32-bit node indices instead of pointers, so the region stays valid when it
+/// is mapped at a different address, e.g. by another process or after a
+/// restart. This is the building block for mmap_lru_cache and shm_lru_cache.
+///
+/// The region layout is: Header, bucket array, node array. All of it is
+/// sized once by requiredSize(); the cache never allocates.
+///
+/// \tparam TKey The key type. Must be trivially copyable
+/// \tparam TValue The type of cached values. Must be trivially copyable
+/// \tparam THash The hash function. Persisted regions can only be restored by
+/// processes that use the same hash function
+/// \tparam TKeyEqual The key comparison function
+template <typename TKey, typename TValue, typename THash = hash<TKey>,
+          typename TKeyEqual = std::equal_to<TKey>>
+class offset_lru_cache {
+  static_assert(std::is_trivially_copyable_v<TKey>,
+                "The keys must be trivially copyable");
+  static_assert(std::is_trivially_copyable_v<TValue>,
+                "The values must be trivially copyable");
+
+public:
+  using index_type = uint32_t;
+  static constexpr index_type Nil = ~index_type(0);
+
+private:
+  static constexpr uint32_t Version = 2;
+  static constexpr char Magic[8] = {'L', 'R', 'U', 'A', 'R', 'E', 'N', 'A'};
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t nodeSize;
+    index_type limit;
+    index_type numBuckets;
+    index_type size;
+    /// Number of nodes handed out from the node array so far
+    index_type numUsed;
+    /// Least recently used entry
+    index_type head;
+    /// Most recently used entry
+    index_type tail;
+    index_type freeList;
+    /// Non-zero, iff the region was closed properly by its owner
+    uint32_t clean;
+  };
+
+  struct Node {
+    TKey key;
+    TValue value;
+    index_type prev;
+    /// The next node in LRU order, or in the freelist
+    index_type next;
+    /// The next node in the same hash bucket
+    index_type chain;
+  };
+
+  static constexpr size_t alignUp(size_t n, size_t align) noexcept {
+    return (n + align - 1) & ~(align - 1);
+  }
+
+  static constexpr index_type bucketsFor(index_type limit) noexcept {
+    index_type ret = 1;
+    while (ret < limit)
+      ret <<= 1;
+    return ret;
+  }
+
+  static constexpr size_t bucketsOffset() noexcept {
+    return alignUp(sizeof(Header), alignof(index_type));
+  }
+
+  static constexpr size_t nodesOffset(index_type limit) noexcept {
+    return alignUp(bucketsOffset() + bucketsFor(limit) * sizeof(index_type),
+                   alignof(Node));
+  }
+
+  Header *header;
+  index_type *buckets;
+  Node *nodes;
+  bool wasRestored;
+
+  THash hasher;
+  TKeyEqual keyEqual;
+
+  index_type bucketOf(const TKey &key) const noexcept {
+    return index_type(hasher(key)) & (header->numBuckets - 1);
+  }
+
+  index_type find(const TKey &key) const noexcept {
+    for (auto i = buckets[bucketOf(key)]; i != Nil; i = nodes[i].chain) {
+      if (keyEqual(nodes[i].key, key))
+        return i;
+    }
+    return Nil;
+  }
+
+  void unlinkList(index_type i) noexcept {
+    auto &nod = nodes[i];
+    if (nod.prev != Nil)
+      nodes[nod.prev].next = nod.next;
+    else
+      header->head = nod.next;
+
+    if (nod.next != Nil)
+      nodes[nod.next].prev = nod.prev;
+    else
+      header->tail = nod.prev;
+  }
+
+  void pushBack(index_type i) noexcept {
+    auto &nod = nodes[i];
+    nod.prev = header->tail;
+    nod.next = Nil;
+    if (header->tail != Nil)
+      nodes[header->tail].next = i;
+    else
+      header->head = i;
+    header->tail = i;
+  }
+
+  void touch(index_type i) noexcept {
+    if (header->tail != i) {
+      unlinkList(i);
+      pushBack(i);
+    }
+  }
+
+  void unlinkChain(index_type i) noexcept {
+    auto *link = &buckets[bucketOf(nodes[i].key)];
+    while (*link != i) {
+      assert(*link != Nil && "The node is not in its bucket");
+      link = &nodes[*link].chain;
+    }
+    *link = nodes[i].chain;
+  }
+
+  void linkChain(index_type i) noexcept {
+    auto &bucket = buckets[bucketOf(nodes[i].key)];
+    nodes[i].chain = bucket;
+    bucket = i;
+  }
+
+  void format(index_type limit) noexcept {
+    std::memcpy(header->magic, Magic, sizeof(Magic));
+    header->version = Version;
+    header->keySize = sizeof(TKey);
+    header->valueSize = sizeof(TValue);
+    header->nodeSize = sizeof(Node);
+    header->limit = limit;
+    header->numBuckets = bucketsFor(limit);
+    header->clean = 0;
+    clear();
+  }
+
+public:
+  /// \brief The number of bytes a region must have to hold a cache with the
+  /// given limit
+  static constexpr size_t requiredSize(index_type limit) noexcept {
+    return nodesOffset(limit) + size_t(limit) * sizeof(Node);
+  }
+
+  /// \brief The alignment a region must have
+  static constexpr size_t requiredAlignment() noexcept {
+    return alignof(Header) > alignof(Node) ? alignof(Header) : alignof(Node);
+  }
+
+  /// \brief Checks whether region contains a cache that was created with the
+  /// same limit and key/value layout
+  static bool isCompatible(const void *region, index_type limit) noexcept {
+    auto *hdr = static_cast<const Header *>(region);
+    return std::memcmp(hdr->magic, Magic, sizeof(Magic)) == 0 &&
+           hdr->version == Version && hdr->keySize == sizeof(TKey) &&
+           hdr->valueSize == sizeof(TValue) && hdr->nodeSize == sizeof(Node) &&
+           hdr->limit == limit && hdr->numBuckets == bucketsFor(limit) &&
+           hdr->size <= limit && hdr->numUsed <= limit;
+  }
+
+  /// \brief Creates a cache inside region.
+  /// \param region The memory region to use. Must be at least
+  /// requiredSize(limit) bytes large and aligned to requiredAlignment()
+  /// \param limit The maximum number of elements that can be cached at a time
+  /// \param restore True, iff the existing contents of region should be
+  /// reused. They are only reused, if the region is compatible (see
+  /// isCompatible()) and was closed properly (see markClean()). Otherwise,
+  /// the region is formatted as an empty cache.
+  offset_lru_cache(void *region, index_type limit, bool restore = true) noexcept
+      : header(static_cast<Header *>(region)),
+        buckets(reinterpret_cast<index_type *>(static_cast<char *>(region) +
+                                               bucketsOffset())),
+        nodes(reinterpret_cast<Node *>(static_cast<char *>(region) +
+                                       nodesOffset(limit))) {
+    assert(limit && limit != Nil && "Invalid cache-limit");
+    assert(reinterpret_cast<uintptr_t>(region) % requiredAlignment() == 0 &&
+           "The region is not sufficiently aligned");
+
+    wasRestored = restore && isCompatible(region, limit) && header->clean;
+    if (!wasRestored)
+      format(limit);
+  }
+
+  /// \brief This type only refers to the region. Copying it would create
+  /// aliasing caches
+  offset_lru_cache(const offset_lru_cache &) = delete;
+  offset_lru_cache &operator=(const offset_lru_cache &) = delete;
+
+  /// \brief True, iff the cache contents were restored from the region
+  /// passed to the constructor
+  bool restored() const noexcept { return wasRestored; }
+
+  /// \brief Marks the region as consistent (clean = true) or as being
+  /// modified (clean = false). Only clean regions are restored.
+  void markClean(bool clean) noexcept { header->clean = clean; }
+
+  /// \brief The number of entries currently in the cache
+  size_t size() const noexcept { return header->size; }
+
+  /// \brief True, iff the cache contains no entries
+  bool empty() const noexcept { return header->size == 0; }
+
+  /// \brief The maximum number of entries that can be cached at a time
+  size_t getLimit() const noexcept { return header->limit; }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true.
+  ///
+  /// If the limit is reached, the least recently used entry is replaced.
+  /// \param key The key to insert
+  /// \param value The to key associated value to insert
+  /// \param update True, iff an existing entry with an equivalent key should
+  /// be overwritten
+  /// \return A tuple, where the first element is a pointer to the cached value
+  /// and the second element denotes whether the insertion actually took place
+  std::pair<TValue *, bool> insert(const TKey &key, const TValue &value,
+                                   bool update = false) noexcept {
+    if (auto i = find(key); i != Nil) {
+      touch(i);
+      if (update)
+        nodes[i].value = value;
+      return {&nodes[i].value, false};
+    }
+
+    index_type i;
+    if (header->size < header->limit) {
+      if (header->freeList != Nil) {
+        i = header->freeList;
+        header->freeList = nodes[i].next;
+      } else {
+        i = header->numUsed++;
+      }
+      ++header->size;
+    } else {
+      // Recycle the least recently used node
+      i = header->head;
+      unlinkChain(i);
+      unlinkList(i);
+    }
+
+    nodes[i].key = key;
+    nodes[i].value = value;
+    linkChain(i);
+    pushBack(i);
+    return {&nodes[i].value, true};
+  }
+
+  /// \brief Looks up the value associated to key in the cache. Updates the LRU
+  /// order.
+  /// \return A reference to the cached value, or std::nullopt, iff key is not
+  /// present in the cache
+  std::optional<std::reference_wrapper<TValue>> get(const TKey &key) noexcept {
+    auto i = find(key);
+    if (i == Nil)
+      return std::nullopt;
+
+    touch(i);
+    return std::ref(nodes[i].value);
+  }
+
+  /// \brief Same as get(const TKey&), but without updating the LRU order.
+  std::optional<std::reference_wrapper<const TValue>>
+  peek(const TKey &key) const noexcept {
+    auto i = find(key);
+    if (i == Nil)
+      return std::nullopt;
+
+    return std::cref(nodes[i].value);
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) noexcept {
+    auto i = find(key);
+    if (i == Nil)
+      return false;
+
+    unlinkChain(i);
+    unlinkList(i);
+    nodes[i].next = header->freeList;
+    header->freeList = i;
+    --header->size;
+    return true;
+  }
+
+  /// \brief Removes all entries from the cache
+  void clear() noexcept {
+    std::fill_n(buckets, header->numBuckets, Nil);
+    header->size = 0;
+    header->numUsed = 0;
+    header->head = header->tail = Nil;
+    header->freeList = Nil;
+  }
+
+  /// \brief Iterates all entries in the cache in LRU order (least recently used
+  /// first) and calls fn(key, value) for each entry. Does not update the
+  /// LRU order.
+  template <typename Fn> void forEach(Fn &&fn) const {
+    for (auto i = header->head; i != Nil; i = nodes[i].next)
+      fn(static_cast<const TKey &>(nodes[i].key),
+         static_cast<const TValue &>(nodes[i].value));
+  }
+};
+} // namespace caching
@@ -170,5 +170,17 @@ public:
 
   // For internal use only
   unsigned minCapacity() const noexcept { return currBlockSize; }
+
+  /// \brief The number of elements that the blocks of an allocator with a
+  /// free list hold, after it has handed out at most peak elements at a time.
+  /// The first block holds reserved elements (see the constructor), all
+  /// further blocks BlockSize elements.
+  static constexpr size_t reservedFor(size_t peak, unsigned reserved) noexcept {
+    if (peak == 0)
+      return 0;
+    if (peak <= reserved)
+      return reserved;
+    return reserved + (peak - reserved + BlockSize - 1) / BlockSize * BlockSize;
+  }
 };
 } // namespace caching
\ No newline at end of file
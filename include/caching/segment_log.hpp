@@ -0,0 +1,325 @@
+#pragma once
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace caching {
+
+///
+/// \brief A log-structured store for opaque byte records on disk. This store
+/// is not thread-safe.
+///
+/// Records are appended to fixed-size segment files. Appends are collected
+/// in a write buffer and written with one large sequential write per batch.
+/// An in-memory index maps each key to the location of its latest record.
+/// Space is reclaimed segment-wise in FIFO order: When more than maxSegments
+/// segments exist, the oldest one is deleted together with all records that
+/// still live in it. Overwritten or erased records just become garbage in
+/// their segment until it is reclaimed.
+///
+/// The segment files are temporary: Stale segments in the directory are
+/// removed on construction and all segments are removed on destruction.
+///
+/// \tparam TKey The key type
+/// \tparam THash The hash function for the in-memory index
+template <typename TKey, typename THash = std::hash<TKey>> class segment_log {
+public:
+  /// \brief The location of a record in a segment file
+  struct location {
+    uint64_t segment;
+    uint64_t offset;
+    uint32_t length;
+  };
+
+private:
+  struct Segment {
+    uint64_t id;
+    int fd;
+    /// The number of bytes appended, including the buffered ones
+    uint64_t size;
+    /// The keys of all records appended to this segment, needed to clean up
+    /// the index when reclaiming the segment
+    std::vector<TKey> keys;
+    /// The number of pending reads that need the file to stay open
+    unsigned pins;
+  };
+
+  struct RetiredFile {
+    int fd;
+    unsigned pins;
+  };
+
+  std::filesystem::path dir;
+  uint64_t segmentSize;
+  size_t writeBatchSize;
+  unsigned maxSegments;
+  uint64_t nextSegment = 0;
+
+  /// Oldest segment first, the last one is the active segment
+  std::deque<Segment> segments;
+  /// Files of reclaimed segments that are still pinned
+  std::unordered_map<uint64_t, RetiredFile> retired;
+  std::unordered_map<TKey, location, THash> index;
+
+  /// Records appended to the active segment, but not written yet
+  std::string writeBuffer;
+  /// The offset of writeBuffer in the active segment
+  uint64_t bufferOffset = 0;
+
+  std::filesystem::path pathOf(uint64_t id) const {
+    return dir / ("segment-" + std::to_string(id) + ".log");
+  }
+
+  Segment *segmentOf(uint64_t id) noexcept {
+    if (segments.empty() || id < segments.front().id)
+      return nullptr;
+    auto idx = id - segments.front().id;
+    return idx < segments.size() ? &segments[idx] : nullptr;
+  }
+
+  void removeFromIndex(const Segment &seg, uint64_t fromOffset) {
+    for (auto &key : seg.keys) {
+      auto it = index.find(key);
+      if (it != index.end() && it->second.segment == seg.id &&
+          it->second.offset >= fromOffset)
+        index.erase(it);
+    }
+  }
+
+  bool openSegment() {
+    auto id = nextSegment++;
+    int fd = ::open(pathOf(id).c_str(),
+                    O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+      return false;
+
+    segments.push_back({id, fd, 0, {}, 0});
+    bufferOffset = 0;
+
+    while (segments.size() > maxSegments)
+      reclaimOldest();
+    return true;
+  }
+
+  void reclaimOldest() {
+    auto &seg = segments.front();
+    removeFromIndex(seg, 0);
+    if (seg.pins)
+      retired.emplace(seg.id, RetiredFile{seg.fd, seg.pins});
+    else
+      ::close(seg.fd);
+    std::error_code ec;
+    std::filesystem::remove(pathOf(seg.id), ec);
+    segments.pop_front();
+  }
+
+public:
+  /// \brief Creates an empty log in directory.
+  /// \param directory The directory for the segment files. It is created if
+  /// it does not exist
+  /// \param segmentSize The maximum size of a segment file in bytes
+  /// \param maxSegments The maximum number of segment files. The disk space
+  /// used is bounded by segmentSize * maxSegments
+  /// \param writeBatchSize The number of bytes to collect before writing them
+  /// to the active segment
+  /// \throws std::system_error if the directory or the first segment cannot
+  /// be created
+  explicit segment_log(std::filesystem::path directory,
+                       uint64_t segmentSize = 64 << 20,
+                       unsigned maxSegments = 16,
+                       size_t writeBatchSize = 1 << 20)
+      : dir(std::move(directory)), segmentSize(segmentSize),
+        writeBatchSize(writeBatchSize), maxSegments(maxSegments ? maxSegments
+                                                                : 1) {
+    std::filesystem::create_directories(dir);
+    for (auto &entry : std::filesystem::directory_iterator(dir)) {
+      auto name = entry.path().filename().string();
+      if (name.rfind("segment-", 0) == 0 && entry.path().extension() == ".log")
+        std::filesystem::remove(entry.path());
+    }
+
+    writeBuffer.reserve(writeBatchSize);
+    if (!openSegment())
+      throw std::system_error(errno, std::generic_category(), "open");
+  }
+
+  segment_log(const segment_log &) = delete;
+  segment_log &operator=(const segment_log &) = delete;
+
+  ~segment_log() {
+    std::error_code ec;
+    for (auto &seg : segments) {
+      ::close(seg.fd);
+      std::filesystem::remove(pathOf(seg.id), ec);
+    }
+    for (auto &[id, file] : retired)
+      ::close(file.fd);
+  }
+
+  /// \brief The number of records reachable through the index
+  size_t size() const noexcept { return index.size(); }
+
+  /// \brief The number of segment files, including the active one
+  size_t numSegments() const noexcept { return segments.size(); }
+
+  bool contains(const TKey &key) const { return index.count(key); }
+
+  /// \brief Appends record as the latest record of key.
+  /// \return False, iff the record is larger than a segment or the log could
+  /// not switch to a new segment
+  bool append(const TKey &key, std::string_view record) {
+    if (record.size() > segmentSize || record.size() > UINT32_MAX)
+      return false;
+
+    if (segments.back().size + record.size() > segmentSize) {
+      // Seal the active segment
+      flush();
+      if (!openSegment())
+        return false;
+    }
+
+    auto &seg = segments.back();
+    index[key] = {seg.id, seg.size, uint32_t(record.size())};
+    seg.keys.push_back(key);
+    seg.size += record.size();
+    writeBuffer.append(record);
+
+    if (writeBuffer.size() >= writeBatchSize)
+      flush();
+    return true;
+  }
+
+  /// \brief Writes the buffered records to the active segment with one
+  /// sequential write. If writing fails, the buffered records are dropped.
+  /// \return True on success
+  bool flush() {
+    if (writeBuffer.empty())
+      return true;
+
+    auto &seg = segments.back();
+    const char *data = writeBuffer.data();
+    size_t remaining = writeBuffer.size();
+    auto offset = bufferOffset;
+    while (remaining) {
+      auto written = ::pwrite(seg.fd, data, remaining, off_t(offset));
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0) {
+        removeFromIndex(seg, bufferOffset);
+        seg.size = bufferOffset;
+        writeBuffer.clear();
+        return false;
+      }
+      data += written;
+      offset += written;
+      remaining -= written;
+    }
+
+    bufferOffset = offset;
+    writeBuffer.clear();
+    return true;
+  }
+
+  /// \brief The location of the latest record of key, if any
+  std::optional<location> locate(const TKey &key) const {
+    auto it = index.find(key);
+    if (it == index.end())
+      return std::nullopt;
+    return it->second;
+  }
+
+  /// \brief The file descriptor of a segment, or -1 if it was reclaimed
+  int fileOf(uint64_t segment) noexcept {
+    auto *seg = segmentOf(segment);
+    return seg ? seg->fd : -1;
+  }
+
+  /// \brief Keeps the file of a segment open until the matching unpin(),
+  /// even if the segment gets reclaimed in the meantime. Used for reads that
+  /// complete asynchronously.
+  /// \return The file descriptor of the segment, or -1 if it was reclaimed
+  int pin(uint64_t segment) noexcept {
+    auto *seg = segmentOf(segment);
+    if (!seg)
+      return -1;
+    ++seg->pins;
+    return seg->fd;
+  }
+
+  /// \brief Releases a pin acquired by pin()
+  void unpin(uint64_t segment) {
+    if (auto *seg = segmentOf(segment)) {
+      assert(seg->pins && "The segment is not pinned");
+      --seg->pins;
+      return;
+    }
+
+    auto it = retired.find(segment);
+    assert(it != retired.end() && "The segment is not pinned");
+    if (--it->second.pins == 0) {
+      ::close(it->second.fd);
+      retired.erase(it);
+    }
+  }
+
+  /// \brief Copies the bytes at loc into out, if they are still in the write
+  /// buffer.
+  /// \return True, iff the record is buffered
+  bool readBuffered(const location &loc, std::string &out) const {
+    if (segments.back().id != loc.segment || loc.offset < bufferOffset)
+      return false;
+
+    out.assign(writeBuffer, loc.offset - bufferOffset, loc.length);
+    return true;
+  }
+
+  /// \brief Reads the latest record of key into out.
+  /// \return True on success. Records that cannot be read are erased.
+  bool read(const TKey &key, std::string &out) {
+    auto it = index.find(key);
+    if (it == index.end())
+      return false;
+
+    auto loc = it->second;
+    if (readBuffered(loc, out))
+      return true;
+
+    out.resize(loc.length);
+    auto fd = fileOf(loc.segment);
+    size_t done = 0;
+    while (done < loc.length) {
+      auto n = ::pread(fd, out.data() + done, loc.length - done,
+                       off_t(loc.offset + done));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) {
+        index.erase(it);
+        return false;
+      }
+      done += n;
+    }
+    return true;
+  }
+
+  /// \brief Removes key from the index. The space of its record is reclaimed
+  /// together with its segment.
+  /// \return True, iff key had a record
+  bool erase(const TKey &key) { return index.erase(key); }
+
+  /// \brief Removes all records from the index
+  void clear() { index.clear(); }
+};
+} // namespace caching
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace caching {
+
+namespace detail {
+/// \brief Holds a trivially copyable T in relaxed atomic words, such that
+/// seqlock readers may load it while a writer stores it. The loaded value is
+/// only meaningful if the reader validates its seqlock afterwards. T must be
+/// default constructible, since loads copy the words into a new T.
+template <typename T> class seqlock_cell {
+  static_assert(std::is_trivially_copyable_v<T> &&
+                    std::is_default_constructible_v<T>,
+                "seqlock_cell requires a trivially copyable, default "
+                "constructible type");
+
+  static constexpr size_t NumWords = (sizeof(T) + 7) / 8;
+
+  std::atomic<uint64_t> words[NumWords] = {};
+
+public:
+  T load() const noexcept {
+    uint64_t buf[NumWords];
+    for (size_t i = 0; i < NumWords; ++i)
+      buf[i] = words[i].load(std::memory_order_relaxed);
+
+    T ret;
+    std::memcpy(&ret, buf, sizeof(T));
+    return ret;
+  }
+
+  void store(const T &value) noexcept {
+    uint64_t buf[NumWords] = {};
+    std::memcpy(buf, &value, sizeof(T));
+    for (size_t i = 0; i < NumWords; ++i)
+      words[i].store(buf[i], std::memory_order_relaxed);
+  }
+};
+} // namespace detail
+} // namespace caching
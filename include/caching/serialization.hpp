@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace caching {
+
+namespace detail {
+/// \brief Writes n as LEB128-encoded unsigned integer
+inline void writeVarint(std::ostream &os, uint64_t n) {
+  char buf[10];
+  unsigned len = 0;
+  do {
+    uint8_t byte = n & 0x7f;
+    n >>= 7;
+    buf[len++] = char(n ? byte | 0x80 : byte);
+  } while (n);
+  os.write(buf, len);
+}
+
+/// \brief Reads an LEB128-encoded unsigned integer into n
+/// \return True, iff reading was successful
+inline bool readVarint(std::istream &is, uint64_t &n) {
+  n = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    auto byte = is.get();
+    if (byte == std::istream::traits_type::eof())
+      return false;
+
+    n |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+/// \brief Reads len elements into the contiguous container value, e.g. a
+/// string or vector. The length usually comes from the stream itself, so it
+/// is untrusted: value grows in bounded chunks as the data arrives, such that
+/// a corrupt length fails at the end of the stream instead of allocating
+/// memory for it.
+/// \return True, iff all elements were read
+template <typename Container>
+bool readElements(std::istream &is, uint64_t len, Container &value) {
+  using T = typename Container::value_type;
+  constexpr size_t ChunkSize = std::max<size_t>(1, (64 << 10) / sizeof(T));
+
+  value.clear();
+  if (len > value.max_size())
+    return false;
+
+  while (value.size() < len) {
+    auto pos = value.size();
+    auto n = size_t(std::min<uint64_t>(len - pos, ChunkSize));
+    value.resize(pos + n);
+    if (!is.read(reinterpret_cast<char *>(value.data() + pos), n * sizeof(T)))
+      return false;
+  }
+  return true;
+}
+} // namespace detail
+
+///
+/// \brief Writes and reads values of type T to/from binary streams. Used by
+/// lru_cache::save() and lru_cache::load().
+///
+/// Specialize this template (or pass a custom type with the same static
+/// member functions) to serialize types that are not supported out of the
+/// box. A serializer provides
+///     static void write(std::ostream &os, const T &value);
+///     static bool read(std::istream &is, T &value);
+/// where read returns false on malformed or truncated input.
+template <typename T, typename = void> struct serializer;
+
+/// \brief Trivially copyable types are written as their object
+/// representation. Hence, the data is not portable between platforms with
+/// different endianness or type layout.
+template <typename T>
+struct serializer<T, std::enable_if_t<std::is_trivially_copyable_v<T>>> {
+  static void write(std::ostream &os, const T &value) {
+    os.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+  static bool read(std::istream &is, T &value) {
+    return bool(is.read(reinterpret_cast<char *>(&value), sizeof(T)));
+  }
+};
+
+/// \brief Strings are written as length-prefix followed by the characters
+template <typename CharT, typename Traits, typename Alloc>
+struct serializer<std::basic_string<CharT, Traits, Alloc>,
+                  std::enable_if_t<std::is_trivially_copyable_v<CharT>>> {
+  using StringTy = std::basic_string<CharT, Traits, Alloc>;
+
+  static void write(std::ostream &os, const StringTy &value) {
+    detail::writeVarint(os, value.size());
+    os.write(reinterpret_cast<const char *>(value.data()),
+             value.size() * sizeof(CharT));
+  }
+  static bool read(std::istream &is, StringTy &value) {
+    uint64_t len;
+    return detail::readVarint(is, len) && detail::readElements(is, len, value);
+  }
+};
+
+/// \brief Vectors of trivially copyable elements are written as length-prefix
+/// followed by the elements
+template <typename T, typename Alloc>
+struct serializer<std::vector<T, Alloc>,
+                  std::enable_if_t<std::is_trivially_copyable_v<T>>> {
+  static void write(std::ostream &os, const std::vector<T, Alloc> &value) {
+    detail::writeVarint(os, value.size());
+    os.write(reinterpret_cast<const char *>(value.data()),
+             value.size() * sizeof(T));
+  }
+  static bool read(std::istream &is, std::vector<T, Alloc> &value) {
+    uint64_t len;
+    return detail::readVarint(is, len) && detail::readElements(is, len, value);
+  }
+};
+} // namespace caching
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#if !defined(CACHING_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <immintrin.h>
+#define CACHING_SET_ASSOC_SSE2 1
+#endif
+
+namespace caching {
+
+///
+/// \brief A set-associative cache with tree-based pseudo-LRU replacement
+/// within each set. This cache is not thread-safe.
+///
+/// Each key is hashed to exactly one set of Ways entries. A lookup compares a
+/// 16-bit tag of the hash against the tags of all ways of the set at once
+/// (using SSE2 where available) and only compares the keys of matching ways.
+/// The tags and the PLRU bits of a set are stored right before its entries,
+/// so an operation reads one contiguous block of memory and does not chase
+/// pointers. There is no global LRU order: The victim is the pseudo-LRU way of
+/// the set the new key maps to. This trades some hit ratio for throughput and
+/// a per-set overhead of 2 * Ways + 2 bytes, rounded up to the alignment of
+/// the entries (e.g. 3 bytes per entry for 8 ways of 8-byte aligned entries).
+///
+/// \tparam TKey The key type. Must be default constructible
+/// \tparam TValue The type of cached values. Must be default constructible
+/// \tparam Ways The associativity. Must be 4, 8 or 16
+/// \tparam THash The hash function. Its result is mixed before use, so the
+/// identity hash of std::hash for integers is fine
+/// \tparam TKeyEqual The key comparison function
+template <typename TKey, typename TValue, unsigned Ways = 8,
+          typename THash = std::hash<TKey>,
+          typename TKeyEqual = std::equal_to<TKey>>
+class set_associative_cache {
+  static_assert(Ways == 4 || Ways == 8 || Ways == 16,
+                "The associativity must be 4, 8 or 16");
+
+  /// The tag of an empty way
+  static constexpr uint16_t Empty = 0;
+
+  struct Entry {
+    TKey key{};
+    TValue value{};
+  };
+
+  struct Set {
+    uint16_t tags[Ways];
+    /// Tree-PLRU bits. Bit i belongs to the inner node i of a complete binary
+    /// tree over the ways (children of node i are 2i+1 and 2i+2) and points
+    /// to the half that contains the pseudo-LRU way: 0 = left, 1 = right.
+    uint16_t plru;
+    Entry ways[Ways];
+  };
+
+  std::unique_ptr<Set[]> sets;
+  size_t numSets;
+  size_t count = 0;
+
+  THash hasher;
+  TKeyEqual keyEqual;
+
+  static uint64_t mix(uint64_t h) noexcept {
+    // The finalizer of MurmurHash3
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  /// Bitmask with bit w set, iff way w of set has the given tag
+  static unsigned matchTags(const Set &set, uint16_t tag) noexcept {
+#if defined(CACHING_SET_ASSOC_SSE2)
+    auto needle = _mm_set1_epi16(short(tag));
+    unsigned mask = 0;
+    for (unsigned w = 0; w < Ways; w += 8) {
+      __m128i vec;
+      if constexpr (Ways == 4)
+        vec = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(set.tags));
+      else
+        vec = _mm_loadu_si128(reinterpret_cast<const __m128i *>(set.tags + w));
+      // Compress the two mask bits per 16-bit lane to one bit
+      auto bytes = _mm_packs_epi16(_mm_cmpeq_epi16(vec, needle),
+                                   _mm_setzero_si128());
+      mask |= unsigned(_mm_movemask_epi8(bytes)) << w;
+    }
+    return Ways == 4 ? mask & 0xf : mask;
+#else
+    unsigned mask = 0;
+    for (unsigned w = 0; w < Ways; ++w)
+      mask |= unsigned(set.tags[w] == tag) << w;
+    return mask;
+#endif
+  }
+
+  static void touch(Set &set, unsigned way) noexcept {
+    // Walk from the root to the leaf of way and let each node point away
+    unsigned node = 0;
+    for (unsigned width = Ways / 2; width; width /= 2) {
+      bool right = way & width;
+      if (right)
+        set.plru &= uint16_t(~(1u << node));
+      else
+        set.plru |= uint16_t(1u << node);
+      node = 2 * node + 1 + right;
+    }
+  }
+
+  static unsigned victim(const Set &set) noexcept {
+    unsigned node = 0;
+    unsigned way = 0;
+    for (unsigned width = Ways / 2; width; width /= 2) {
+      bool right = set.plru & (1u << node);
+      way |= right ? width : 0;
+      node = 2 * node + 1 + right;
+    }
+    return way;
+  }
+
+  struct Location {
+    Set *set;
+    Entry *ways;
+    uint16_t tag;
+  };
+
+  Location locate(const TKey &key) const noexcept {
+    auto h = mix(uint64_t(hasher(key)));
+    auto &set = sets[size_t(h) & (numSets - 1)];
+    auto tag = uint16_t(h >> 48);
+    if (tag == Empty)
+      tag = 1;
+    return {&set, set.ways, tag};
+  }
+
+  int findWay(const Location &loc, const TKey &key) const noexcept {
+    for (auto mask = matchTags(*loc.set, loc.tag); mask; mask &= mask - 1) {
+      auto way = __builtin_ctz(mask);
+      if (keyEqual(loc.ways[way].key, key))
+        return way;
+    }
+    return -1;
+  }
+
+public:
+  /// \brief Initializes a new, empty set_associative_cache
+  /// \param limit The minimum number of elements that can be cached at a
+  /// time. It is rounded up to a power of two number of sets
+  explicit set_associative_cache(size_t limit) {
+    numSets = 1;
+    while (numSets * Ways < limit)
+      numSets <<= 1;
+    sets.reset(new Set[numSets]);
+    clear();
+  }
+
+  /// \brief The maximum number of elements that can be cached at a time
+  size_t capacity() const noexcept { return numSets * Ways; }
+
+  /// \brief The number of entries currently in the cache
+  size_t size() const noexcept { return count; }
+
+  /// \brief True, iff the cache contains no entries
+  bool empty() const noexcept { return count == 0; }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true.
+  ///
+  /// If the set of key is full, its pseudo-LRU entry is replaced.
+  /// \return A tuple, where the first element is a pointer to the cached value
+  /// and the second element denotes whether the insertion actually took place
+  template <typename K, typename V>
+  std::pair<TValue *, bool> insert(K &&key, V &&value, bool update = false) {
+    auto loc = locate(key);
+    if (auto way = findWay(loc, key); way >= 0) {
+      touch(*loc.set, way);
+      if (update)
+        loc.ways[way].value = std::forward<V>(value);
+      return {&loc.ways[way].value, false};
+    }
+
+    unsigned way;
+    if (auto empty = matchTags(*loc.set, Empty)) {
+      way = __builtin_ctz(empty);
+      ++count;
+    } else {
+      way = victim(*loc.set);
+    }
+
+    loc.set->tags[way] = loc.tag;
+    loc.ways[way].key = std::forward<K>(key);
+    loc.ways[way].value = std::forward<V>(value);
+    touch(*loc.set, way);
+    return {&loc.ways[way].value, true};
+  }
+
+  /// \brief Looks up the value associated to key in the cache. Updates the
+  /// pseudo-LRU order of its set.
+  /// \return A mutable reference to the cached value associated with key if
+  /// found. Returns std::nullopt, iff key is not present in the cache.
+  std::optional<std::reference_wrapper<TValue>> get(const TKey &key) noexcept {
+    auto loc = locate(key);
+    auto way = findWay(loc, key);
+    if (way < 0)
+      return std::nullopt;
+
+    touch(*loc.set, way);
+    return std::ref(loc.ways[way].value);
+  }
+
+  /// \brief Same as get(const TKey&), but without updating the pseudo-LRU
+  /// order.
+  std::optional<std::reference_wrapper<const TValue>>
+  peek(const TKey &key) const noexcept {
+    auto loc = locate(key);
+    auto way = findWay(loc, key);
+    if (way < 0)
+      return std::nullopt;
+
+    return std::cref(loc.ways[way].value);
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) {
+    auto loc = locate(key);
+    auto way = findWay(loc, key);
+    if (way < 0)
+      return false;
+
+    loc.set->tags[way] = Empty;
+    loc.ways[way] = Entry();
+    --count;
+    return true;
+  }
+
+  /// \brief Removes all entries from the cache
+  void clear() {
+    for (size_t i = 0; i < numSets; ++i) {
+      auto &set = sets[i];
+      std::fill(std::begin(set.tags), std::end(set.tags), Empty);
+      set.plru = 0;
+      if (count)
+        std::fill(std::begin(set.ways), std::end(set.ways), Entry());
+    }
+    count = 0;
+  }
+
+  /// \brief Calls fn(key, value) for each entry in unspecified order
+  template <typename Fn> void forEach(Fn &&fn) const {
+    for (size_t s = 0; s < numSets; ++s) {
+      const auto &set = sets[s];
+      for (unsigned w = 0; w < Ways; ++w) {
+        if (set.tags[w] != Empty)
+          fn(static_cast<const TKey &>(set.ways[w].key),
+             static_cast<const TValue &>(set.ways[w].value));
+      }
+    }
+  }
+};
+} // namespace caching
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <new>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "caching/hash.hpp"
+#include "caching/lru_cache.hpp"
+#include "caching/serialization.hpp"
+
+namespace caching {
+
+///
+/// \brief A handle to an immutable value of type T, whose ownership is shared
+/// by all copies of the handle. The reference count is embedded in the same
+/// allocation as the value, so creating a value allocates once (unlike
+/// std::make_shared, there is no weak count and no deleter).
+///
+/// Copying and destroying handles is thread-safe; The value is destroyed by
+/// whichever thread releases the last handle.
+///
+/// \tparam T The type of the shared value
+template <typename T> class shared_value {
+  struct Block {
+    std::atomic<size_t> refs{1};
+    const T value;
+
+    template <typename... Args>
+    explicit Block(Args &&...args) : value(std::forward<Args>(args)...) {}
+  };
+
+  Block *block = nullptr;
+
+  explicit shared_value(Block *block) noexcept : block(block) {}
+
+public:
+  using element_type = T;
+
+  /// \brief Creates an empty handle
+  shared_value() noexcept = default;
+
+  shared_value(const shared_value &other) noexcept : block(other.block) {
+    if (block)
+      block->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  shared_value(shared_value &&other) noexcept
+      : block(std::exchange(other.block, nullptr)) {}
+  shared_value &operator=(shared_value other) noexcept {
+    std::swap(block, other.block);
+    return *this;
+  }
+  ~shared_value() { reset(); }
+
+  /// \brief Constructs a new shared value from args
+  template <typename... Args> static shared_value make(Args &&...args) {
+    return shared_value(new Block(std::forward<Args>(args)...));
+  }
+
+  /// \brief Releases the reference, if any, and empties this handle
+  void reset() noexcept {
+    if (block && block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete block;
+    block = nullptr;
+  }
+
+  /// \brief True, iff this handle refers to a value
+  explicit operator bool() const noexcept { return block != nullptr; }
+
+  /// \brief The shared value. Requires a non-empty handle
+  const T &operator*() const noexcept { return block->value; }
+  const T *operator->() const noexcept { return &block->value; }
+
+  /// \brief The shared value, or nullptr if this handle is empty
+  const T *get() const noexcept { return block ? &block->value : nullptr; }
+
+  /// \brief The number of handles that share the value. Only a snapshot, if
+  /// other threads copy or release handles concurrently
+  size_t useCount() const noexcept {
+    return block ? block->refs.load(std::memory_order_relaxed) : 0;
+  }
+};
+
+///
+/// \brief A handle to an immutable byte buffer, whose ownership is shared by
+/// all copies of the handle. The reference count, the size and the bytes
+/// are stored in a single allocation.
+///
+/// Copying and destroying handles is thread-safe; The buffer is freed by
+/// whichever thread releases the last handle.
+class shared_blob {
+  struct Header {
+    std::atomic<size_t> refs{1};
+    size_t size;
+
+    explicit Header(size_t size) noexcept : size(size) {}
+  };
+
+  Header *header = nullptr;
+
+  char *bytes() const noexcept { return reinterpret_cast<char *>(header + 1); }
+
+  static void release(Header *header) noexcept {
+    header->~Header();
+    ::operator delete(header);
+  }
+
+public:
+  /// \brief Creates an empty handle
+  shared_blob() noexcept = default;
+
+  /// \brief Creates a new buffer with a copy of data
+  explicit shared_blob(std::string_view data)
+      : shared_blob(create(data.size(), [data](char *dst) {
+          std::memcpy(dst, data.data(), data.size());
+        })) {}
+
+  shared_blob(const shared_blob &other) noexcept : header(other.header) {
+    if (header)
+      header->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  shared_blob(shared_blob &&other) noexcept
+      : header(std::exchange(other.header, nullptr)) {}
+  shared_blob &operator=(shared_blob other) noexcept {
+    std::swap(header, other.header);
+    return *this;
+  }
+  ~shared_blob() { reset(); }
+
+  /// \brief Creates a new buffer of size bytes, that fill(char *) writes in
+  /// place, e.g. by reading or decompressing directly into it. The buffer is
+  /// immutable afterwards.
+  template <typename Fn> static shared_blob create(size_t size, Fn &&fill) {
+    shared_blob ret;
+    ret.header = new (::operator new(sizeof(Header) + size)) Header(size);
+    std::invoke(std::forward<Fn>(fill), ret.bytes());
+    return ret;
+  }
+
+  /// \brief Releases the reference, if any, and empties this handle
+  void reset() noexcept {
+    if (header && header->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      release(header);
+    header = nullptr;
+  }
+
+  /// \brief True, iff this handle refers to a buffer
+  explicit operator bool() const noexcept { return header != nullptr; }
+
+  /// \brief The bytes of the buffer, or nullptr if this handle is empty
+  const char *data() const noexcept { return header ? bytes() : nullptr; }
+
+  /// \brief The number of bytes of the buffer. Zero for empty handles
+  size_t size() const noexcept { return header ? header->size : 0; }
+
+  /// \brief True, iff the buffer has no bytes or this handle is empty
+  bool empty() const noexcept { return size() == 0; }
+
+  /// \brief The bytes of the buffer as string_view
+  std::string_view view() const noexcept { return {data(), size()}; }
+
+  /// \brief The number of handles that share the buffer. Only a snapshot, if
+  /// other threads copy or release handles concurrently
+  size_t useCount() const noexcept {
+    return header ? header->refs.load(std::memory_order_relaxed) : 0;
+  }
+};
+
+/// \brief Blobs are written as length-prefix followed by the bytes and read
+/// into a new buffer. The value is only assigned, if the blob was read
+/// completely.
+template <> struct serializer<shared_blob> {
+  static void write(std::ostream &os, const shared_blob &value) {
+    detail::writeVarint(os, value.size());
+    os.write(value.data(), value.size());
+  }
+  static bool read(std::istream &is, shared_blob &value) {
+    uint64_t len;
+    if (!detail::readVarint(is, len))
+      return false;
+
+    // The length is untrusted: Long blobs are read in bounded chunks first,
+    // such that a corrupt length fails at the end of the stream instead of
+    // allocating memory for it
+    constexpr uint64_t MaxDirectRead = 64 << 10;
+    if (len > MaxDirectRead) {
+      std::string buf;
+      if (!detail::readElements(is, len, buf))
+        return false;
+      value = shared_blob(buf);
+      return true;
+    }
+
+    bool ok = true;
+    auto blob = shared_blob::create(size_t(len), [&](char *dst) {
+      ok = bool(is.read(dst, std::streamsize(len)));
+    });
+    if (ok)
+      value = std::move(blob);
+    return ok;
+  }
+};
+
+///
+/// \brief An adaptor of lru_cache, whose values are shared handles, such as
+/// shared_blob or shared_value<T>. Lookups return a copy of the handle
+/// instead of a reference into the cache, so the value stays valid after
+/// later operations on the cache, and an eviction merely drops the cache's
+/// reference. Hence, large values can be served to many readers without
+/// copying them.
+///
+/// The cache itself is not thread-safe, but the returned handles may be
+/// passed to and released by other threads.
+///
+/// \tparam TKey The key type used for fast element access
+/// \tparam THandle The shared handle type of the values
+/// \tparam THash The hash function
+template <typename TKey, typename THandle = shared_blob,
+          typename THash = hash<TKey>>
+class shared_lru_cache {
+  lru_cache<TKey, THandle, 1024, THash> cache;
+
+public:
+  /// \brief Initializes a new, empty shared_lru_cache
+  /// \param limit The maximum number of entries
+  explicit shared_lru_cache(size_t limit) : cache(limit) {}
+
+  /// \brief The number of entries currently in the cache
+  size_t size() const noexcept { return cache.size(); }
+
+  /// \brief The maximum number of entries that can be cached at a time
+  size_t getLimit() const noexcept { return cache.getLimit(); }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true. The cache
+  /// shares the ownership of value.
+  /// \return True, iff key was not present before
+  bool insert(const TKey &key, THandle value, bool update = false) {
+    assert(value && "Empty handles cannot be cached");
+    return cache.insert(key, std::move(value), update).second;
+  }
+
+  /// \brief Looks up the value associated to key in the cache. Updates the
+  /// LRU order.
+  /// \return A handle sharing the cached value, or an empty handle, iff key is
+  /// not present in the cache
+  THandle get(const TKey &key) {
+    auto ret = cache.get(key);
+    return ret ? ret->get() : THandle();
+  }
+
+  /// \brief Same as get(const TKey&), but without affecting the LRU order
+  THandle peek(const TKey &key) const {
+    auto ret = cache.peek(key);
+    return ret ? ret->get() : THandle();
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// Handles returned earlier stay valid.
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) { return cache.erase(key); }
+
+  /// \brief Removes all entries from the cache. Handles returned earlier stay
+  /// valid.
+  void clear() noexcept { cache.clear(); }
+
+  /// \brief The wrapped cache
+  lru_cache<TKey, THandle, 1024, THash> &underlying() noexcept {
+    return cache;
+  }
+};
+} // namespace caching
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "caching/offset_lru_cache.hpp"
+
+namespace caching {
+
+namespace detail {
+/// \brief The part of a shared cache segment that precedes the cache region
+struct shm_segment_header {
+  enum : uint32_t { Uninitialized = 0, Ready = 1 };
+
+  std::atomic<uint32_t> state;
+  pthread_mutex_t mutex;
+};
+
+/// \brief Owns a mapping of a POSIX shared memory object. Exactly one of the
+/// processes that open the same name creates and initializes it.
+class shm_mapping {
+  void *addr = nullptr;
+  size_t len = 0;
+  bool isCreator = false;
+
+  /// How long to wait for another process to initialize the segment
+  static constexpr unsigned InitTimeoutMs = 5000;
+
+  [[noreturn]] static void fail(int err, const char *what) {
+    throw std::system_error(err, std::generic_category(), what);
+  }
+
+  static void sleepMs() noexcept {
+    timespec ts{0, 1000 * 1000};
+    ::nanosleep(&ts, nullptr);
+  }
+
+public:
+  /// \brief Opens or creates the shared memory object name with len bytes.
+  /// \throws std::system_error if the object cannot be opened or mapped, has
+  /// a different size, or is not initialized by its creator in time
+  shm_mapping(const std::string &name, size_t len) : len(len) {
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+      isCreator = true;
+      if (::ftruncate(fd, off_t(len)) != 0) {
+        auto err = errno;
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        fail(err, "ftruncate");
+      }
+    } else if (errno == EEXIST) {
+      fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+      if (fd < 0)
+        fail(errno, "shm_open");
+
+      // The creator may not have resized the object yet
+      struct stat st;
+      for (unsigned i = 0;; ++i) {
+        if (::fstat(fd, &st) != 0) {
+          auto err = errno;
+          ::close(fd);
+          fail(err, "fstat");
+        }
+        if (st.st_size != 0)
+          break;
+        if (i == InitTimeoutMs) {
+          ::close(fd);
+          fail(ETIMEDOUT, "shm_open");
+        }
+        sleepMs();
+      }
+      if (size_t(st.st_size) != len) {
+        ::close(fd);
+        fail(EINVAL, "The shared cache has a different size");
+      }
+    } else {
+      fail(errno, "shm_open");
+    }
+
+    addr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    auto err = errno;
+    ::close(fd);
+    if (addr == MAP_FAILED)
+      fail(err, "mmap");
+
+    if (!isCreator) {
+      auto &state = header().state;
+      for (unsigned i = 0;
+           state.load(std::memory_order_acquire) != shm_segment_header::Ready;
+           ++i) {
+        if (i == InitTimeoutMs) {
+          ::munmap(addr, len);
+          fail(ETIMEDOUT, "The shared cache was not initialized");
+        }
+        sleepMs();
+      }
+    }
+  }
+
+  shm_mapping(const shm_mapping &) = delete;
+  shm_mapping &operator=(const shm_mapping &) = delete;
+
+  ~shm_mapping() { ::munmap(addr, len); }
+
+  shm_segment_header &header() const noexcept {
+    return *static_cast<shm_segment_header *>(addr);
+  }
+  void *data() const noexcept { return addr; }
+
+  /// \brief True, iff this process created the shared memory object
+  bool created() const noexcept { return isCreator; }
+};
+} // namespace detail
+
+///
+/// \brief A thread- and process-safe LRU cache with a fixed limit for
+/// trivially copyable keys and values that is shared by all processes that
+/// open it with the same name.
+///
+/// The cache (index, nodes and LRU links, see offset_lru_cache) lives in a
+/// POSIX shared memory object, so forked worker processes can share one cache
+/// instead of each holding its own copy. All operations are serialized by a
+/// process-shared robust mutex. If a process dies while holding the lock, the
+/// next process that acquires it clears the possibly inconsistent cache.
+///
+/// Since other processes may modify the cache concurrently, lookups return
+/// copies of the cached values instead of references.
+///
+/// \tparam TKey The key type. Must be trivially copyable
+/// \tparam TValue The type of cached values. Must be trivially copyable
+/// \tparam THash The hash function. Must be the same for all processes
+/// \tparam TKeyEqual The key comparison function
+template <typename TKey, typename TValue, typename THash = hash<TKey>,
+          typename TKeyEqual = std::equal_to<TKey>>
+class shm_lru_cache {
+  using CacheTy = offset_lru_cache<TKey, TValue, THash, TKeyEqual>;
+
+public:
+  using index_type = typename CacheTy::index_type;
+
+private:
+  static constexpr size_t regionOffset() noexcept {
+    constexpr auto align = CacheTy::requiredAlignment();
+    return (sizeof(detail::shm_segment_header) + align - 1) & ~(align - 1);
+  }
+
+  static void *attach(detail::shm_mapping &mapping, index_type limit) {
+    auto *region = static_cast<char *>(mapping.data()) + regionOffset();
+    if (!mapping.created() && !CacheTy::isCompatible(region, limit))
+      throw std::invalid_argument(
+          "The shared cache was created with a different limit or layout");
+    return region;
+  }
+
+  detail::shm_mapping mapping;
+  mutable CacheTy cache;
+
+  class lock_guard {
+    const shm_lru_cache &owner;
+
+  public:
+    explicit lock_guard(const shm_lru_cache &owner) : owner(owner) {
+      auto *mtx = &owner.mapping.header().mutex;
+      auto err = ::pthread_mutex_lock(mtx);
+      if (err == EOWNERDEAD) {
+        // The previous owner died inside a critical section
+        owner.cache.clear();
+        ::pthread_mutex_consistent(mtx);
+      } else if (err != 0) {
+        throw std::system_error(err, std::generic_category(),
+                                "pthread_mutex_lock");
+      }
+    }
+    ~lock_guard() { ::pthread_mutex_unlock(&owner.mapping.header().mutex); }
+  };
+
+public:
+  /// \brief Opens the shared cache name, or creates it if it does not exist.
+  /// \param name The name of the shared memory object, e.g. "/my-cache"
+  /// \param limit The maximum number of elements that can be cached at a time.
+  /// Must be the same for all processes
+  /// \throws std::system_error if the shared memory cannot be created or
+  /// mapped, std::invalid_argument if an existing cache has a different limit
+  shm_lru_cache(const std::string &name, index_type limit)
+      : mapping(name, regionOffset() + CacheTy::requiredSize(limit)),
+        cache(attach(mapping, limit), limit, !mapping.created()) {
+    if (mapping.created()) {
+      pthread_mutexattr_t attr;
+      ::pthread_mutexattr_init(&attr);
+      ::pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+      ::pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+      ::pthread_mutex_init(&mapping.header().mutex, &attr);
+      ::pthread_mutexattr_destroy(&attr);
+
+      // Allows other processes to attach without formatting the region
+      cache.markClean(true);
+      mapping.header().state.store(detail::shm_segment_header::Ready,
+                                   std::memory_order_release);
+    }
+  }
+
+  shm_lru_cache(const shm_lru_cache &) = delete;
+  shm_lru_cache &operator=(const shm_lru_cache &) = delete;
+
+  /// \brief Removes the shared memory object name. Processes that have it
+  /// opened can continue to use it; new processes create a new cache.
+  static bool remove(const std::string &name) noexcept {
+    return ::shm_unlink(name.c_str()) == 0;
+  }
+
+  /// \brief The number of entries currently in the cache
+  size_t size() const {
+    lock_guard lck(*this);
+    return cache.size();
+  }
+
+  /// \brief The maximum number of entries that can be cached at a time
+  size_t getLimit() const noexcept { return cache.getLimit(); }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true.
+  /// \return True, iff the insertion actually took place
+  bool insert(const TKey &key, const TValue &value, bool update = false) {
+    lock_guard lck(*this);
+    return cache.insert(key, value, update).second;
+  }
+
+  /// \brief Looks up the value associated to key in the cache. Updates the LRU
+  /// order.
+  /// \return A copy of the cached value, or std::nullopt, iff key is not
+  /// present in the cache
+  std::optional<TValue> get(const TKey &key) {
+    lock_guard lck(*this);
+    if (auto ret = cache.get(key))
+      return ret->get();
+    return std::nullopt;
+  }
+
+  /// \brief Same as get(const TKey&), but without updating the LRU order.
+  std::optional<TValue> peek(const TKey &key) const {
+    lock_guard lck(*this);
+    if (auto ret = cache.peek(key))
+      return ret->get();
+    return std::nullopt;
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// \return True, iff an entry was removed
+  bool erase(const TKey &key) {
+    lock_guard lck(*this);
+    return cache.erase(key);
+  }
+
+  /// \brief Removes all entries from the cache
+  void clear() {
+    lock_guard lck(*this);
+    cache.clear();
+  }
+
+  /// \brief Iterates all entries in the cache in LRU order (least recently used
+  /// first) and calls fn(key, value) for each entry while holding the lock.
+  /// Does not update the LRU order.
+  template <typename Fn> void forEach(Fn &&fn) const {
+    lock_guard lck(*this);
+    cache.forEach(std::forward<Fn>(fn));
+  }
+};
+} // namespace caching
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#if !defined(CACHING_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <immintrin.h>
+#define CACHING_SMALL_LRU_SSE2 1
+#if defined(__AVX2__)
+#define CACHING_SMALL_LRU_AVX2 1
+#endif
+#endif
+
+namespace caching {
+
+///
+/// \brief An LRU cache for very small capacities and integer keys that finds
+/// keys with a SIMD linear scan instead of hashing. This cache is not
+/// thread-safe.
+///
+/// The keys are stored in an aligned array and compared against the searched
+/// key with AVX2 or SSE2 compare-and-movemask (scalar code is used on other
+/// platforms or if CACHING_NO_SIMD is defined). The LRU order is maintained
+/// as a permutation of age bytes: the most recently used entry has age 0 and
+/// the least recently used one has age size()-1. Accessing an entry
+/// increments all ages below its own in one SIMD pass.
+///
+/// For capacities up to a few dozen entries, e.g. memoization caches like the
+/// fib example in tests/LRUTest.cpp, this is faster than hashing through an
+/// std::unordered_map and never allocates.
+///
+/// \tparam TKey The key type. Must be an integral type of 4 or 8 bytes
+/// \tparam TValue The type of cached values. Must be default constructible
+/// \tparam N The maximum number of elements that can be cached at a time. Must
+/// be at most 64
+template <typename TKey, typename TValue, size_t N> class small_lru_cache {
+  static_assert(std::is_integral_v<TKey> &&
+                    (sizeof(TKey) == 4 || sizeof(TKey) == 8),
+                "The keys must be 32- or 64-bit integers");
+  static_assert(N > 0 && N <= 64, "The capacity must be in [1, 64]");
+
+  /// The number of keys per 32-byte vector
+  static constexpr size_t KeysPerVector = 32 / sizeof(TKey);
+  static constexpr size_t NumKeySlots =
+      (N + KeysPerVector - 1) / KeysPerVector * KeysPerVector;
+  static constexpr size_t NumAgeSlots = (N + 15) / 16 * 16;
+
+  /// Marks unused age slots. It is never smaller than the age of an entry, so
+  /// touch() never modifies it
+  static constexpr uint8_t UnusedAge = 0x7f;
+
+  alignas(32) TKey keys[NumKeySlots] = {};
+  alignas(16) uint8_t ages[NumAgeSlots];
+  TValue values[N] = {};
+  uint8_t count = 0;
+
+  /// Bitmask with one bit per key slot, where bit i is set iff keys[i] == key
+  uint64_t matchMask(TKey key) const noexcept {
+    uint64_t mask = 0;
+#if defined(CACHING_SMALL_LRU_AVX2)
+    auto needle = sizeof(TKey) == 8 ? _mm256_set1_epi64x(int64_t(key))
+                                    : _mm256_set1_epi32(int32_t(key));
+    for (size_t i = 0; i < NumKeySlots; i += KeysPerVector) {
+      auto vec = _mm256_load_si256(reinterpret_cast<const __m256i *>(keys + i));
+      uint64_t bits;
+      if constexpr (sizeof(TKey) == 8)
+        bits = unsigned(_mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(vec, needle))));
+      else
+        bits = unsigned(_mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(vec, needle))));
+      mask |= bits << i;
+    }
+#elif defined(CACHING_SMALL_LRU_SSE2)
+    constexpr size_t KeysPer128 = 16 / sizeof(TKey);
+    auto needle = sizeof(TKey) == 8 ? _mm_set1_epi64x(int64_t(key))
+                                    : _mm_set1_epi32(int32_t(key));
+    for (size_t i = 0; i < NumKeySlots; i += KeysPer128) {
+      auto vec = _mm_load_si128(reinterpret_cast<const __m128i *>(keys + i));
+      auto eq = _mm_cmpeq_epi32(vec, needle);
+      uint64_t bits;
+      if constexpr (sizeof(TKey) == 8) {
+        // SSE2 has no 64-bit compare: Both 32-bit halves must be equal
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        bits = unsigned(_mm_movemask_pd(_mm_castsi128_pd(eq)));
+      } else {
+        bits = unsigned(_mm_movemask_ps(_mm_castsi128_ps(eq)));
+      }
+      mask |= bits << i;
+    }
+#else
+    for (size_t i = 0; i < NumKeySlots; ++i)
+      mask |= uint64_t(keys[i] == key) << i;
+#endif
+    return mask & (count == 64 ? ~uint64_t(0) : (uint64_t(1) << count) - 1);
+  }
+
+  int find(TKey key) const noexcept {
+    auto mask = matchMask(key);
+    return mask ? __builtin_ctzll(mask) : -1;
+  }
+
+  /// Makes entry i the most recently used one: Increments all ages below the
+  /// age of i and sets its age to 0
+  void touch(size_t i) noexcept {
+    auto age = ages[i];
+#if defined(CACHING_SMALL_LRU_SSE2)
+    auto vage = _mm_set1_epi8(char(age));
+    for (size_t j = 0; j < NumAgeSlots; j += 16) {
+      auto *ptr = reinterpret_cast<__m128i *>(ages + j);
+      auto vec = _mm_load_si128(ptr);
+      // All ages are below 0x80, so the signed comparison is fine. The mask is
+      // -1 for the ages to increment
+      _mm_store_si128(ptr, _mm_sub_epi8(vec, _mm_cmplt_epi8(vec, vage)));
+    }
+#else
+    for (size_t j = 0; j < NumAgeSlots; ++j)
+      ages[j] += ages[j] < age;
+#endif
+    ages[i] = 0;
+  }
+
+  /// The slot of the entry with the given age
+  size_t slotOfAge(uint8_t age) const noexcept {
+#if defined(CACHING_SMALL_LRU_SSE2)
+    auto vage = _mm_set1_epi8(char(age));
+    for (size_t j = 0; j < NumAgeSlots; j += 16) {
+      auto vec = _mm_load_si128(reinterpret_cast<const __m128i *>(ages + j));
+      if (auto bits = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(vec, vage))))
+        return j + __builtin_ctz(bits);
+    }
+#else
+    for (size_t j = 0; j < NumAgeSlots; ++j) {
+      if (ages[j] == age)
+        return j;
+    }
+#endif
+    assert(false && "The ages are not a permutation");
+    return 0;
+  }
+
+public:
+  /// \brief Initializes a new, empty small_lru_cache
+  small_lru_cache() noexcept(std::is_nothrow_default_constructible_v<TValue>) {
+    for (auto &age : ages)
+      age = UnusedAge;
+  }
+
+  /// \brief The maximum number of elements that can be cached at a time
+  static constexpr size_t capacity() noexcept { return N; }
+
+  /// \brief The number of entries currently in the cache
+  size_t size() const noexcept { return count; }
+
+  /// \brief True, iff the cache contains no entries
+  bool empty() const noexcept { return count == 0; }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true.
+  ///
+  /// If the cache is full, the least recently used entry is replaced.
+  /// \return A tuple, where the first element is a pointer to the cached value
+  /// and the second element denotes whether the insertion actually took place
+  template <typename V>
+  std::pair<TValue *, bool> insert(TKey key, V &&value, bool update = false) {
+    if (auto i = find(key); i >= 0) {
+      touch(i);
+      if (update)
+        values[i] = std::forward<V>(value);
+      return {&values[i], false};
+    }
+
+    size_t i;
+    if (count < N) {
+      i = count++;
+      // Ages up to count - 2 exist, so the new entry pushes all of them back
+      ages[i] = uint8_t(i);
+    } else {
+      i = slotOfAge(uint8_t(N - 1));
+    }
+
+    keys[i] = key;
+    values[i] = std::forward<V>(value);
+    touch(i);
+    return {&values[i], true};
+  }
+
+  /// \brief Looks up the value associated to key in the cache. Updates the LRU
+  /// order.
+  /// \return A pointer to the cached value, or nullptr, iff key is not present
+  /// in the cache
+  TValue *get(TKey key) noexcept {
+    auto i = find(key);
+    if (i < 0)
+      return nullptr;
+
+    touch(i);
+    return &values[i];
+  }
+
+  /// \brief Same as get(TKey), but without updating the LRU order.
+  const TValue *peek(TKey key) const noexcept {
+    auto i = find(key);
+    return i < 0 ? nullptr : &values[i];
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// \return True, iff an entry was removed
+  bool erase(TKey key) {
+    auto i = find(key);
+    if (i < 0)
+      return false;
+
+    // Close the gap in the ages
+    auto age = ages[i];
+    for (size_t j = 0; j < count; ++j)
+      ages[j] -= ages[j] > age;
+
+    // Keep the entries contiguous by moving the last one into the gap
+    auto last = --count;
+    if (size_t(i) != last) {
+      keys[i] = keys[last];
+      values[i] = std::move(values[last]);
+      ages[i] = ages[last];
+    }
+    keys[last] = TKey();
+    values[last] = TValue();
+    ages[last] = UnusedAge;
+    return true;
+  }
+
+  /// \brief Removes all entries from the cache
+  void clear() {
+    for (size_t i = 0; i < count; ++i) {
+      keys[i] = TKey();
+      values[i] = TValue();
+      ages[i] = UnusedAge;
+    }
+    count = 0;
+  }
+
+  /// \brief Iterates all entries in the cache in LRU order (least recently used
+  /// first) and calls fn(key, value) for each entry. Does not update the
+  /// LRU order.
+  template <typename Fn> void forEach(Fn &&fn) const {
+    uint8_t order[N];
+    for (size_t i = 0; i < count; ++i)
+      order[count - 1 - ages[i]] = uint8_t(i);
+    for (size_t i = 0; i < count; ++i)
+      fn(keys[order[i]], values[order[i]]);
+  }
+};
+} // namespace caching
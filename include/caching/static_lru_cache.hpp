@@ -0,0 +1,257 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include "caching/hash.hpp"
+
+namespace caching {
+
+///
+/// \brief An LRU cache with a compile-time fixed capacity that stores all
+/// entries inline. This cache is not thread-safe.
+///
+/// As opposed to lru_cache, constructing and destroying a static_lru_cache
+/// does not touch the heap, so it is suitable for short-lived caches that live
+/// on the stack. The links of the LRU list and the open-addressing index use
+/// the smallest unsigned integer type that can address N entries.
+///
+/// All member functions are constexpr, so the cache can be used in constant
+/// expressions, given that the hash function is constexpr as well.
+///
+/// \tparam TKey The key type. Must be default constructible
+/// \tparam TValue The type of cached values. Must be default constructible
+/// \tparam N The maximum number of elements that can be cached at a time
+/// \tparam THash The hash function
+/// \tparam TKeyEqual The key comparison function
+template <typename TKey, typename TValue, size_t N,
+          typename THash = hash<TKey>,
+          typename TKeyEqual = std::equal_to<TKey>>
+class static_lru_cache {
+  static_assert(N > 0, "The capacity must not be 0");
+  static_assert(N < UINT32_MAX, "The capacity is too large");
+
+public:
+  using index_type = std::conditional_t<
+      (N < UINT8_MAX), uint8_t,
+      std::conditional_t<(N < UINT16_MAX), uint16_t, uint32_t>>;
+
+private:
+  static constexpr index_type Nil = index_type(~index_type(0));
+
+  static constexpr size_t bucketsFor(size_t n) noexcept {
+    size_t ret = 1;
+    while (ret < n)
+      ret <<= 1;
+    return ret;
+  }
+
+  /// The index is at most half full, which keeps the probe sequences short
+  static constexpr size_t NumBuckets = bucketsFor(2 * N);
+  static constexpr size_t NotFound = NumBuckets;
+
+  struct Slot {
+    TKey key{};
+    TValue value{};
+    index_type prev = Nil;
+    /// The next entry in LRU order, or in the freelist
+    index_type next = Nil;
+  };
+
+  std::array<Slot, N> slots{};
+  /// Open-addressing index with linear probing, maps to positions in slots
+  std::array<index_type, NumBuckets> buckets{};
+
+  index_type head = Nil;
+  index_type tail = Nil;
+  index_type freeList = Nil;
+  index_type count = 0;
+  /// The number of slots handed out so far
+  index_type numUsed = 0;
+
+  THash hasher{};
+  TKeyEqual keyEqual{};
+
+  constexpr size_t homeOf(const TKey &key) const {
+    return size_t(hasher(key)) & (NumBuckets - 1);
+  }
+
+  constexpr size_t find(const TKey &key) const {
+    for (auto pos = homeOf(key); buckets[pos] != Nil;
+         pos = (pos + 1) & (NumBuckets - 1)) {
+      if (keyEqual(slots[buckets[pos]].key, key))
+        return pos;
+    }
+    return NotFound;
+  }
+
+  /// Removes the index entry at pos by shifting back the following entries of
+  /// its probe sequence
+  constexpr void eraseBucket(size_t hole) {
+    for (auto pos = (hole + 1) & (NumBuckets - 1); buckets[pos] != Nil;
+         pos = (pos + 1) & (NumBuckets - 1)) {
+      auto home = homeOf(slots[buckets[pos]].key);
+      // Can the entry at pos be moved to the hole without moving it before its
+      // home position?
+      bool movable = hole <= pos ? (home <= hole || home > pos)
+                                 : (home <= hole && home > pos);
+      if (movable) {
+        buckets[hole] = buckets[pos];
+        hole = pos;
+      }
+    }
+    buckets[hole] = Nil;
+  }
+
+  constexpr void insertBucket(index_type idx) {
+    auto pos = homeOf(slots[idx].key);
+    while (buckets[pos] != Nil)
+      pos = (pos + 1) & (NumBuckets - 1);
+    buckets[pos] = idx;
+  }
+
+  constexpr void unlinkList(index_type idx) noexcept {
+    auto &slot = slots[idx];
+    if (slot.prev != Nil)
+      slots[slot.prev].next = slot.next;
+    else
+      head = slot.next;
+
+    if (slot.next != Nil)
+      slots[slot.next].prev = slot.prev;
+    else
+      tail = slot.prev;
+  }
+
+  constexpr void pushBack(index_type idx) noexcept {
+    auto &slot = slots[idx];
+    slot.prev = tail;
+    slot.next = Nil;
+    if (tail != Nil)
+      slots[tail].next = idx;
+    else
+      head = idx;
+    tail = idx;
+  }
+
+  constexpr void touch(index_type idx) noexcept {
+    if (tail != idx) {
+      unlinkList(idx);
+      pushBack(idx);
+    }
+  }
+
+public:
+  /// \brief Initializes a new, empty static_lru_cache
+  constexpr static_lru_cache() noexcept(
+      std::is_nothrow_default_constructible_v<Slot>) {
+    for (auto &bucket : buckets)
+      bucket = Nil;
+  }
+
+  /// \brief The maximum number of elements that can be cached at a time
+  static constexpr size_t capacity() noexcept { return N; }
+
+  /// \brief The number of entries currently in the cache
+  constexpr size_t size() const noexcept { return count; }
+
+  /// \brief True, iff the cache contains no entries
+  constexpr bool empty() const noexcept { return count == 0; }
+
+  /// \brief Inserts the (key, value) pair into the cache, if there is no
+  /// other entry with an equivalent key or if update is true.
+  ///
+  /// If the cache is full, the least recently used entry is replaced.
+  /// \return A tuple, where the first element is a pointer to the cached value
+  /// and the second element denotes whether the insertion actually took place
+  template <typename K, typename V>
+  constexpr std::pair<TValue *, bool> insert(K &&key, V &&value,
+                                             bool update = false) {
+    if (auto pos = find(key); pos != NotFound) {
+      auto idx = buckets[pos];
+      touch(idx);
+      if (update)
+        slots[idx].value = std::forward<V>(value);
+      return {&slots[idx].value, false};
+    }
+
+    index_type idx = Nil;
+    if (count < N) {
+      if (freeList != Nil) {
+        idx = freeList;
+        freeList = slots[idx].next;
+      } else {
+        idx = numUsed++;
+      }
+      ++count;
+    } else {
+      // Recycle the least recently used slot
+      idx = head;
+      eraseBucket(find(slots[idx].key));
+      unlinkList(idx);
+    }
+
+    slots[idx].key = std::forward<K>(key);
+    slots[idx].value = std::forward<V>(value);
+    insertBucket(idx);
+    pushBack(idx);
+    return {&slots[idx].value, true};
+  }
+
+  /// \brief Looks up the value associated to key in the cache. Updates the LRU
+  /// order.
+  /// \return A pointer to the cached value, or nullptr, iff key is not present
+  /// in the cache
+  constexpr TValue *get(const TKey &key) {
+    auto pos = find(key);
+    if (pos == NotFound)
+      return nullptr;
+
+    touch(buckets[pos]);
+    return &slots[buckets[pos]].value;
+  }
+
+  /// \brief Same as get(const TKey&), but without updating the LRU order.
+  constexpr const TValue *peek(const TKey &key) const {
+    auto pos = find(key);
+    return pos == NotFound ? nullptr : &slots[buckets[pos]].value;
+  }
+
+  /// \brief Removes the entry associated with key from the cache, if any.
+  /// \return True, iff an entry was removed
+  constexpr bool erase(const TKey &key) {
+    auto pos = find(key);
+    if (pos == NotFound)
+      return false;
+
+    auto idx = buckets[pos];
+    eraseBucket(pos);
+    unlinkList(idx);
+    slots[idx].next = freeList;
+    freeList = idx;
+    --count;
+    return true;
+  }
+
+  /// \brief Removes all entries from the cache
+  constexpr void clear() noexcept {
+    for (auto &bucket : buckets)
+      bucket = Nil;
+    head = tail = freeList = Nil;
+    count = numUsed = 0;
+  }
+
+  /// \brief Iterates all entries in the cache in LRU order (least recently used
+  /// first) and calls fn(key, value) for each entry. Does not update the
+  /// LRU order.
+  template <typename Fn> constexpr void forEach(Fn &&fn) const {
+    for (auto idx = head; idx != Nil; idx = slots[idx].next)
+      fn(slots[idx].key, slots[idx].value);
+  }
+};
+} // namespace caching
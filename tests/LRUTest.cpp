@@ -1,5 +1,35 @@
+#include "caching/async_lru_cache.hpp"
+#include "caching/compact_lru_cache.hpp"
+#include "caching/compressed_lru_cache.hpp"
+#include "caching/concurrent_clock_cache.hpp"
+#include "caching/concurrent_lru_cache.hpp"
+#include "caching/front_cache.hpp"
+#include "caching/hybrid_cache.hpp"
 #include "caching/lru_cache.hpp"
+#include "caching/maintenance_executor.hpp"
+#include "caching/memoize.hpp"
+#include "caching/mmap_lru_cache.hpp"
+#include "caching/negative_cache.hpp"
+#include "caching/set_associative_cache.hpp"
+#include "caching/shared_value.hpp"
+#include "caching/shm_lru_cache.hpp"
+#include "caching/small_lru_cache.hpp"
+#include "caching/static_lru_cache.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
 
 template <typename T> void printAll(const T &map) {
   map.forEach(
@@ -36,6 +66,41 @@ uint64_t fibIt(uint64_t n) {
 
 using namespace caching;
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+/// Loads that are suspended until main() resumes them
+std::vector<std::coroutine_handle<>> deferred;
+
+struct deferred_load {
+  uint64_t value;
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) { deferred.push_back(h); }
+  uint64_t await_resume() const noexcept { return value; }
+};
+
+/// A coroutine that starts eagerly and is not awaited
+struct fire_and_forget {
+  struct promise_type {
+    fire_and_forget get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+fire_and_forget printSquare(async_lru_cache<uint64_t, uint64_t> &cache,
+                            uint64_t key) {
+  auto loader = [](uint64_t k) { return deferred_load{k * k}; };
+  inline_executor executor;
+  try {
+    std::cout << co_await cache.asyncGetOrLoad(key, loader, executor) << " ";
+  } catch (const std::exception &e) {
+    std::cout << e.what() << " ";
+  }
+}
+#endif
+
 int main() {
   uint64_t N = 65;
 
@@ -43,6 +108,340 @@ int main() {
   std::cout << fib(N, cache) << std::endl;
   std::cout << fibIt(N) << std::endl;
 
+  small_lru_cache<uint64_t, uint64_t, 10> smallCache;
+  std::cout << fib(N, smallCache) << std::endl;
+
+  static_lru_cache<uint64_t, uint64_t, 10> stackCache;
+  std::cout << fib(N, stackCache) << " ";
+  stackCache.erase(N);
+  std::cout << stackCache.size() << " " << *stackCache.peek(N - 1) << std::endl;
+
+  set_associative_cache<uint64_t, uint64_t, 4> setAssoc(10);
+  std::cout << fib(N, setAssoc) << " " << setAssoc.capacity() << " "
+            << setAssoc.erase(N) << " " << setAssoc.get(N).has_value()
+            << std::endl;
+
+  auto memoFib = memoize<10, uint64_t(uint64_t)>(
+      [](auto &self, uint64_t n) -> uint64_t {
+        return n < 2 ? n : self(n - 1) + self(n - 2);
+      });
+  std::cout << memoFib(N) << std::endl;
+
+  lru_cache<int, int> resized(100);
+  for (int i = 0; i < 100; ++i)
+    resized.insert(i, i);
+  resized.setLimit(10);
+  while (resized.pendingEvictions())
+    resized.evictSome(16);
+  std::cout << resized.size() << std::endl;
+  resized.eraseIf([](int key, int) { return key % 2 == 0; });
+  printAll(resized);
+
+  std::stringstream snapshot;
+  resized.save(snapshot);
+  lru_cache<int, int> restored(3);
+  restored.load(snapshot);
+  printAll(restored);
+
+  // A snapshot with a corrupt string length fails to load, instead of
+  // allocating memory for the length
+  std::string corrupt(lru_cache<int, std::string>::SnapshotMagic, 8);
+  corrupt += std::string("\x01\x00\x00\x00\x00\xff\xff\xff\xff\x7f", 10);
+  std::stringstream corruptSnapshot(corrupt);
+  lru_cache<int, std::string> strings(3);
+  std::cout << strings.load(corruptSnapshot) << std::endl;
+
+  // Insertions of cached keys pay off pending evictions as well
+  resized.setLimit(2);
+  while (resized.pendingEvictions())
+    resized.insert(99, 99);
+  printAll(resized);
+
+  lru_cache<int, int> prepared(4);
+  auto second = [&prepared] {
+    auto first = prepared.findOrPrepare(1);
+    if (!first)
+      first.fill(10);
+    prepared.erase(1);
+    return prepared.findOrPrepare(2);
+  }();
+  second.fill(20);
+  {
+    // An abandoned handle removes its prepared entry again
+    auto abandoned = prepared.findOrPrepare(3);
+  }
+  std::cout << prepared.size() << " " << *prepared.get(2) << " "
+            << bool(prepared.get(3)) << std::endl;
+
+  using Point = std::tuple<int, std::string>;
+  lru_cache<Point, int, 1024, hash<Point>> hashed(2);
+  hashed.insert(Point(1, "one"), 1);
+  hashed.insert(Point(2, "two"), 2);
+  std::cout << (hash<std::string>{}("two") == hash<std::string_view>{}("two"))
+            << " " << *hashed.get(Point(2, "two")) << " "
+            << hashed.get(Point(2, "one")).has_value() << std::endl;
+
+  lru_cache<uint64_t, uint64_t> nodeBased(1000);
+  compact_lru_cache<uint64_t, uint64_t> compact(1000);
+  for (uint64_t i = 0; i < 1000; ++i) {
+    nodeBased.insert(i, i);
+    compact.insert(i, i);
+  }
+  std::cout << nodeBased.memoryUsage().overheadPerEntry() << " "
+            << compact.memoryUsage().overheadPerEntry() << std::endl;
+
+  {
+    // The index grows from a single slot and survives evictions and erasures
+    compact_lru_cache<int, int> growing(100, 1);
+    for (int i = 0; i < 200; ++i)
+      growing.insert(i, i);
+    for (int i = 0; i < 200; i += 3)
+      growing.erase(i);
+    int found = 0;
+    for (int i = 0; i < 200; ++i)
+      found += growing.peek(i).has_value();
+    std::cout << growing.size() << " " << found << std::endl;
+  }
+
+  arena_lru_cache<int> words(2);
+  for (std::string word : {"alpha", "beta", "gamma"})
+    words.insert(word, int(word.size()));
+  std::cout << words.peek(std::string_view("alpha")).has_value() << " ";
+  printAll(words);
+
+  {
+    // Compressible values take less than their size of the byte limit
+    compressed_lru_cache<int> blobs(1000);
+    std::string blob;
+    for (int i = 0; i < 1000; ++i)
+      blob += std::to_string(i % 10);
+    for (int i = 0; i < 4; ++i)
+      blobs.insert(i, blob);
+    std::cout << blobs.size() << " " << (blobs.bytes() < 1000) << " "
+              << (blobs.get(0) == blob) << std::endl;
+  }
+
+  {
+    // Threads insert and read their own keys concurrently
+    concurrent_lru_cache<uint64_t, uint64_t> sharded(100000, 4);
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> hits{0};
+    for (uint64_t t = 0; t < 4; ++t) {
+      threads.emplace_back([&sharded, &hits, t] {
+        for (uint64_t i = t * 1000; i < (t + 1) * 1000; ++i)
+          sharded.insert(i, i * i);
+        for (uint64_t i = t * 1000; i < (t + 1) * 1000; ++i)
+          hits += sharded.get(i) == i * i;
+      });
+    }
+    for (auto &thread : threads)
+      thread.join();
+    std::cout << sharded.size() << " " << hits << std::endl;
+  }
+
+  {
+    // A background worker evicts down to the limit. Meanwhile, the cache may
+    // exceed it by the headroom of its shards
+    std::atomic<int> tasks{0};
+    {
+      maintenance_executor maintenance;
+      concurrent_lru_cache<uint64_t, uint64_t> background(100, 1, &maintenance);
+      for (uint64_t i = 0; i < 1000; ++i)
+        background.insert(i, i);
+      maintenance.submit([&tasks] { ++tasks; });
+      std::cout << (background.size() <= 125) << " ";
+    }
+    std::cout << tasks << std::endl;
+  }
+
+  {
+    // Threads racing to insert the same keys leave one entry per key
+    concurrent_clock_cache<uint64_t, uint64_t> clock(1000);
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; ++t) {
+      threads.emplace_back([&clock, t] {
+        for (uint64_t i = 0; i < 500; ++i)
+          clock.insert(i, t);
+      });
+    }
+    for (auto &thread : threads)
+      thread.join();
+    size_t entries = 0;
+    clock.forEach([&entries](uint64_t, uint64_t) { ++entries; });
+    std::cout << clock.size() << " " << entries << std::endl;
+  }
+
+  {
+    // Front caches serve hot entries until the shared cache modifies them
+    versioned_cache<uint64_t, uint64_t> versioned(16, 100);
+    front_cache<uint64_t, uint64_t> front(versioned), other(versioned);
+    versioned.insert(1, 10);
+    front.get(1);
+    front.get(1);
+    other.erase(1);
+    versioned.insert(1, 11);
+    std::cout << *front.get(1) << " " << front.hits() << " "
+              << front.misses() << std::endl;
+  }
+
+  {
+    // Handles stay valid after their entry is erased
+    shared_lru_cache<int> sharedBlobs(2);
+    sharedBlobs.insert(1, shared_blob("blob"));
+    auto blob = sharedBlobs.get(1);
+    sharedBlobs.erase(1);
+
+    // A truncated or corrupt blob leaves the value unchanged
+    std::stringstream blobStream;
+    serializer<shared_blob>::write(blobStream, blob);
+    auto truncated = blobStream.str().substr(0, 3);
+    std::stringstream truncatedStream(truncated);
+    std::stringstream corruptStream(std::string("\xff\xff\xff\xff\x7f"));
+    bool ok = serializer<shared_blob>::read(truncatedStream, blob) ||
+              serializer<shared_blob>::read(corruptStream, blob);
+    std::cout << blob.view() << " " << blob.useCount() << " " << ok << " "
+              << serializer<shared_blob>::read(blobStream, blob) << std::endl;
+  }
+
+  {
+    // Absent keys reach the backend once, until they are inserted
+    negative_cache<int, int> lookups(4, 100);
+    int backendCalls = 0;
+    auto backend = [&backendCalls](int key) -> std::optional<int> {
+      ++backendCalls;
+      if (key % 2)
+        return std::nullopt;
+      return key;
+    };
+    for (int round = 0; round < 3; ++round) {
+      for (int key = 0; key < 4; ++key)
+        lookups.getOrLoad(key, backend);
+    }
+    lookups.insert(1, 1);
+    std::cout << backendCalls << " " << lookups.filtered() << " "
+              << *lookups.getOrLoad(1, backend) << std::endl;
+  }
+
+  {
+    // Keys that were absent and then inserted stay out of the filter, after
+    // other absent keys were recorded and the cache evicted them
+    negative_cache<int, int> lookups(4, 1000);
+    int backendCalls = 0;
+    auto absent = [](int) -> std::optional<int> { return std::nullopt; };
+    auto present = [&backendCalls](int key) -> std::optional<int> {
+      ++backendCalls;
+      return key;
+    };
+    for (int key = 0; key < 300; ++key) {
+      lookups.getOrLoad(key, absent);
+      lookups.insert(key, key);
+    }
+    for (int key = 1000; key < 1690; ++key)
+      lookups.getOrLoad(key, absent);
+    for (int key = 0; key < 296; ++key)
+      lookups.getOrLoad(key, present);
+    std::cout << backendCalls << std::endl;
+  }
+
+  lru_cache<int, std::string> pinned(3);
+  for (int i = 0; i < 3; ++i)
+    pinned.insert(i, std::to_string(i));
+  if (auto zero = pinned.pin(0)) {
+    pinned.get(1);
+    pinned.get(2);
+    // Evictions skip the pinned, least recently used entry 0
+    pinned.insert(3, "3");
+    pinned.insert(4, "4");
+    pinned.erase(0);
+    std::cout << *zero << " " << zero.isDetached() << " "
+              << pinned.pinnedCount() << std::endl;
+  }
+  printAll(pinned);
+
+  {
+    // The entries of an mmap_lru_cache survive closing and reopening it
+    auto path = std::filesystem::temp_directory_path() / "LRUTest.mmap";
+    std::filesystem::remove(path);
+    {
+      mmap_lru_cache<uint64_t, uint64_t> persistent(path.string(), 10);
+      fib(N, persistent);
+    }
+    mmap_lru_cache<uint64_t, uint64_t> persistent(path.string(), 10);
+    std::cout << persistent.restored() << " " << *persistent.get(N)
+              << std::endl;
+    std::filesystem::remove(path);
+  }
+
+  {
+    // A forked process fills the shared cache, that its parent reads
+    const std::string name = "/LRUTest.shm";
+    shm_lru_cache<uint64_t, uint64_t>::remove(name);
+    shm_lru_cache<uint64_t, uint64_t> shared(name, 10);
+    if (auto pid = ::fork(); pid == 0) {
+      fib(N, shared);
+      std::_Exit(0);
+    } else {
+      ::waitpid(pid, nullptr, 0);
+    }
+    std::cout << shared.size() << " " << *shared.get(N) << std::endl;
+    shm_lru_cache<uint64_t, uint64_t>::remove(name);
+  }
+
+  {
+    // Entries evicted from the memory tier are demoted to the file tier
+    auto dir = std::filesystem::temp_directory_path() / "LRUTest.hybrid";
+    std::filesystem::remove_all(dir);
+    {
+      hybrid_cache<uint64_t, uint64_t> tiered(4, dir, 1 << 16, 4, 256);
+      std::cout << fib(N, tiered) << " " << tiered.memorySize() << " "
+                << tiered.diskSize() << " " << *tiered.get(10) << std::endl;
+    }
+    std::filesystem::remove_all(dir);
+  }
+
+  {
+    // Misses of the memory tier read the file tier asynchronously
+    auto dir = std::filesystem::temp_directory_path() / "LRUTest.async";
+    std::filesystem::remove_all(dir);
+    {
+      hybrid_cache<uint64_t, uint64_t> tiered(4, dir, 1 << 16, 4, 256);
+      async_file_io io;
+      fib(N, tiered);
+      tiered.flush();
+
+      uint64_t sum = 0;
+      for (uint64_t n : {10, 20, 30})
+        tiered.getAsync(n, io, [&sum](auto result) { sum += result->get(); });
+      io.submit();
+      while (io.outstanding())
+        io.poll(1);
+      std::cout << sum << " " << tiered.memorySize() << std::endl;
+    }
+    std::filesystem::remove_all(dir);
+  }
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+  {
+    // Concurrent misses of the same key share one load
+    async_lru_cache<uint64_t, uint64_t> squares(1);
+    printSquare(squares, 3);
+    printSquare(squares, 3);
+    printSquare(squares, 4);
+    std::cout << squares.pendingLoads() << " ";
+    for (auto h : std::exchange(deferred, {}))
+      h.resume();
+    printSquare(squares, 4);
+
+    // Errors while caching the loaded value are rethrown to the awaiters
+    squares.sync().setEvictionHandler([](auto &&...) {
+      throw std::runtime_error("evict");
+    });
+    printSquare(squares, 5);
+    std::exchange(deferred, {}).front().resume();
+    std::cout << squares.pendingLoads() << std::endl;
+  }
+#endif
+
   /* lru_cache<int, double> cache(3, 3);
 
    cache.insert(3, 4.5);